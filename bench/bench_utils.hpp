@@ -0,0 +1,42 @@
+#pragma once
+
+#include <iostream>
+#include <sstream>
+#include <string>
+
+namespace flang::bench
+{
+
+// Program with `n_forms` function definitions and top-level calls
+inline std::string generateProgram(size_t n_forms)
+{
+    std::ostringstream os;
+    for (size_t i = 0; i < n_forms; ++i) {
+        os << "(func f" << i << " (x y)\n"
+           << "  (cond (less x y)\n"
+           << "    (plus x (times y " << i << "))\n"
+           << "    (minus x (head '(1 2 3)))))\n"
+           << "(setq v" << i << " (f" << i << " " << i << " 7))\n";
+    }
+    return os.str();
+}
+
+// Swallows everything printed by benchmarked programs
+class SilencedStdout
+{
+public:
+    SilencedStdout()
+        : previous_(std::cout.rdbuf(sink_.rdbuf()))
+    {
+    }
+    ~SilencedStdout()
+    {
+        std::cout.rdbuf(previous_);
+    }
+
+private:
+    std::ostringstream sink_;
+    std::streambuf* previous_;
+};
+
+} // namespace flang::bench
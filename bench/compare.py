@@ -0,0 +1,33 @@
+import json
+import sys
+from pathlib import Path
+from typing import Dict
+
+
+def load_times(path: Path) -> Dict[str, float]:
+    report = json.loads(path.read_text())
+    return {
+        b["name"]: b["cpu_time"]
+        for b in report["benchmarks"]
+        if b.get("run_type", "iteration") == "iteration"
+    }
+
+
+def main() -> int:
+    if len(sys.argv) != 3:
+        print("Usage: python3 bench/compare.py <base.json> <new.json>")
+        return 1
+    base = load_times(Path(sys.argv[1]))
+    new = load_times(Path(sys.argv[2]))
+
+    print(f"{'benchmark':<60} {'base':>12} {'new':>12} {'change':>8}")
+    for name, base_time in base.items():
+        if name not in new:
+            continue
+        change = (new[name] - base_time) / base_time * 100 if base_time else 0.0
+        print(f"{name:<60} {base_time:>12.1f} {new[name]:>12.1f} {change:>+7.1f}%")
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,278 @@
+#include <algorithm>
+#include <benchmark/benchmark.h>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <sstream>
+
+#include "bench_utils.hpp"
+#include "flang/embed.hpp"
+#include "flang/eval/builtins.hpp"
+#include "flang/eval/data_reader.hpp"
+#include "flang/eval/environment_stack.hpp"
+#include "flang/eval/eval_visitor.hpp"
+#include "flang/eval/future.hpp"
+#include "flang/eval/incremental.hpp"
+#include "flang/eval/jit.hpp"
+#include "flang/eval/scheduler.hpp"
+#include "flang/parse/parser.hpp"
+#include "flang/tokenize/tokenizer.hpp"
+
+namespace flang::bench
+{
+
+// Lookup of a global variable from `depth` nested call frames
+static void BM_EnvironmentLookup(benchmark::State& state)
+{
+    EnvironmentStack env;
+    env.storeVariable("global", std::make_shared<Integer>(42));
+    for (int64_t i = 0; i < state.range(0); ++i) {
+        env.pushEnvironment();
+        env.storeVariable("local", std::make_shared<Integer>(i));
+    }
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(env.loadVariable("global"));
+    }
+    state.SetComplexityN(state.range(0));
+}
+BENCHMARK(BM_EnvironmentLookup)->RangeMultiplier(8)->Range(1, 512)->Complexity();
+
+static void BM_CallBuiltin(benchmark::State& state, std::string const& name, std::vector<std::shared_ptr<Element>> const& args)
+{
+    EvalVisitor visitor;
+    BuiltinsRegistry registry(&visitor);
+    std::shared_ptr<Builtin> builtin;
+    for (auto const& candidate : registry.getAllBuiltins()) {
+        if (candidate->getName() == name) {
+            builtin = candidate;
+        }
+    }
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(registry.callBuiltin(*builtin, args));
+    }
+}
+
+static auto one   = std::make_shared<Integer>(1);
+static auto two   = std::make_shared<Integer>(2);
+static auto quote = std::make_shared<List>(std::vector<std::shared_ptr<Element>> {std::make_shared<Identifier>("quote"), std::make_shared<List>(std::vector<std::shared_ptr<Element>> {one, two})});
+
+BENCHMARK_CAPTURE(BM_CallBuiltin, plus, std::string("plus"), std::vector<std::shared_ptr<Element>> {one, two});
+BENCHMARK_CAPTURE(BM_CallBuiltin, less, std::string("less"), std::vector<std::shared_ptr<Element>> {one, two});
+BENCHMARK_CAPTURE(BM_CallBuiltin, equal, std::string("equal"), std::vector<std::shared_ptr<Element>> {one, two});
+BENCHMARK_CAPTURE(BM_CallBuiltin, head, std::string("head"), std::vector<std::shared_ptr<Element>> {quote});
+BENCHMARK_CAPTURE(BM_CallBuiltin, quote, std::string("quote"), std::vector<std::shared_ptr<Element>> {one});
+
+// Bulk loading of data that is already in memory
+static void BM_ReadCsv(benchmark::State& state)
+{
+    std::ostringstream os;
+    for (int64_t row = 0; row < state.range(0); ++row) {
+        os << row << ",-" << row * 7 << "," << row % 100 << ",12345678\n";
+    }
+    auto text = os.str();
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(readCsv(text));
+    }
+    state.SetBytesProcessed(state.iterations() * text.size());
+}
+BENCHMARK(BM_ReadCsv)->Range(1 << 10, 1 << 16);
+
+static void BM_ReadSExpressions(benchmark::State& state)
+{
+    std::ostringstream os;
+    for (int64_t row = 0; row < state.range(0); ++row) {
+        os << "(row " << row << " (point " << row % 100 << " -7) 'tag" << row % 10 << " true)\n";
+    }
+    auto text = os.str();
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(readSExpressions(text));
+    }
+    state.SetBytesProcessed(state.iterations() * text.size());
+}
+BENCHMARK(BM_ReadSExpressions)->Range(1 << 10, 1 << 16);
+
+// 64 looping scripts time-sliced with `fuel` safe points per slice
+static void BM_Scheduler(benchmark::State& state)
+{
+    const size_t N_SCRIPTS = 64;
+    auto prog              = parse(Tokenizer().tokenize("(setq i 0) (while (less i 1000) (setq i (plus i 1)))"));
+    std::stringbuf output;
+    for (auto _ : state) {
+        Scheduler scheduler(2, state.range(0));
+        for (size_t i = 0; i < N_SCRIPTS; ++i) {
+            scheduler.submit("loop", prog, &output);
+        }
+        benchmark::DoNotOptimize(scheduler.run());
+    }
+    state.SetItemsProcessed(state.iterations() * N_SCRIPTS);
+}
+BENCHMARK(BM_Scheduler)->RangeMultiplier(10)->Range(10, 100000)->UseRealTime();
+
+// One small rule script evaluated for many inputs
+static std::string const RULE_SCRIPT = "(func excess (amount limit) (cond (greater amount limit) (minus amount limit) 0))\n"
+                                       "(setq verdict (excess amount 100))\n"
+                                       "verdict";
+
+static void BM_RuleFromSource(benchmark::State& state)
+{
+    std::stringbuf output;
+    int64_t amount = 0;
+    for (auto _ : state) {
+        EvalVisitor visitor(DEFAULT_OUTPUT_BUFFER_SIZE, &output);
+        visitor.storeVariable("amount", makeInteger(amount++ % 200));
+        benchmark::DoNotOptimize(visitor.evalProgram(parse(Tokenizer().tokenize(RULE_SCRIPT))));
+    }
+}
+BENCHMARK(BM_RuleFromSource);
+
+static void BM_RulePrepared(benchmark::State& state)
+{
+    std::stringbuf output;
+    PreparedProgram rules(RULE_SCRIPT);
+    ExecutionContext context(&output);
+    int64_t amount = 0;
+    for (auto _ : state) {
+        context.bind("amount", makeInteger(amount++ % 200));
+        benchmark::DoNotOptimize(context.run(rules));
+    }
+}
+BENCHMARK(BM_RulePrepared);
+
+// A loop that builds the same code and evals it, with an EvalCache of the given capacity
+static void BM_EvalConstructed(benchmark::State& state)
+{
+    auto prog = parse(Tokenizer().tokenize("(setq i 0)\n"
+                                           "(while (less i 1000)\n"
+                                           "    (setq i (eval (cons 'cond (cons (cons 'less '(i 500)) (cons (cons 'plus '(i 1)) '((plus i (times 1 1)))))))))"));
+    uint64_t hits = 0;
+    uint64_t evals = 0;
+    for (auto _ : state) {
+        EvalVisitor visitor;
+        visitor.evalCache().setCapacity(state.range(0));
+        visitor.visitProgram(prog);
+        hits += visitor.evalCache().hits();
+        evals += visitor.evalCache().hits() + visitor.evalCache().misses();
+    }
+    state.counters["hit_rate"] = evals == 0 ? 0.0 : static_cast<double>(hits) / evals;
+}
+BENCHMARK(BM_EvalConstructed)->Arg(0)->Arg(EvalCache::DEFAULT_CAPACITY);
+
+// fib(24) split into futures down to fib(12), on `n` threads
+static void BM_ParallelFib(benchmark::State& state)
+{
+    auto prog = parse(Tokenizer().tokenize("(func fib (n) (cond (less n 2) n (plus (fib (minus n 1)) (fib (minus n 2)))))\n"
+                                           "(func join (a b) (plus (touch a) b))\n"
+                                           "(func pfib (n) (cond (less n 12) (fib n) (join (future (pfib (minus n 1))) (pfib (minus n 2)))))\n"
+                                           "(pfib 24)"));
+    FuturePool::instance().setThreads(state.range(0));
+    for (auto _ : state) {
+        EvalVisitor visitor;
+        benchmark::DoNotOptimize(visitor.evalProgram(prog));
+    }
+    FuturePool::instance().setThreads(std::thread::hardware_concurrency());
+}
+BENCHMARK(BM_ParallelFib)->Arg(1)->Arg(2)->Arg(4)->Arg(8)->UseRealTime();
+
+// Sum of a table of `n` ones read by index, from an array or by walking a list
+static void BM_IndexedTable(benchmark::State& state, bool array)
+{
+    std::ostringstream os;
+    os << "(func nth (l k) (cond (equal k 0) (head l) (nth (tail l) (minus k 1))))\n";
+    if (array) {
+        os << "(setq table (makearray " << state.range(0) << " 1))\n"
+           << "(func get (k) (aref table k))\n";
+    } else {
+        os << "(setq table '(";
+        for (int64_t i = 0; i < state.range(0); ++i) {
+            os << "1 ";
+        }
+        os << "))\n"
+           << "(func get (k) (nth table k))\n";
+    }
+    os << "(setq acc (makearray 1 0))\n"
+       << "(func add (i) (prog () ((aset acc 0 (plus (aref acc 0) (get i))) (plus i 1))))\n"
+       << "(setq i 0)\n"
+       << "(while (less i " << state.range(0) << ") (setq i (add i)))\n"
+       << "(aref acc 0)";
+    auto prog = parse(Tokenizer().tokenize(os.str()));
+    for (auto _ : state) {
+        EvalVisitor visitor;
+        benchmark::DoNotOptimize(visitor.evalProgram(prog));
+    }
+    state.SetComplexityN(state.range(0));
+}
+BENCHMARK_CAPTURE(BM_IndexedTable, array, true)->RangeMultiplier(2)->Range(64, 512)->Complexity();
+BENCHMARK_CAPTURE(BM_IndexedTable, list, false)->RangeMultiplier(2)->Range(64, 512)->Complexity();
+
+// Re-evaluating a script of `n` independent loops after one of them is edited
+static void BM_IncrementalUpdate(benchmark::State& state)
+{
+    auto script = [&state](int64_t edited_bound) {
+        std::ostringstream os;
+        for (int64_t i = 0; i < state.range(0); ++i) {
+            os << "(setq i" << i << " 0) (while (less i" << i << " " << (i == 0 ? edited_bound : 100) << ") (setq i" << i << " (plus i" << i << " 1)))\n";
+        }
+        return parse(Tokenizer().tokenize(os.str()));
+    };
+    Program versions[] = {script(100), script(200)};
+    EvalVisitor visitor;
+    IncrementalProgram program(visitor);
+    program.update(versions[0]);
+    size_t version = 0;
+    for (auto _ : state) {
+        version = 1 - version;
+        benchmark::DoNotOptimize(program.update(versions[version]));
+    }
+}
+BENCHMARK(BM_IncrementalUpdate)->RangeMultiplier(8)->Range(8, 4096);
+
+// Tokenize, parse and evaluate one program from tests/data
+static void BM_Program(benchmark::State& state, std::string const& source)
+{
+    SilencedStdout silenced;
+    for (auto _ : state) {
+        auto prog = parse(Tokenizer().tokenize(source));
+        EvalVisitor visitor;
+        visitor.setDataDirectory(FLANG_TEST_DATA_DIR);
+        visitor.visitProgram(prog);
+    }
+}
+
+// Evaluation only, with a fresh interpreter per iteration
+static void BM_Eval(benchmark::State& state, std::string const& source, bool jit)
+{
+    SilencedStdout silenced;
+    auto prog = parse(Tokenizer().tokenize(source));
+    for (auto _ : state) {
+        EvalVisitor visitor;
+        visitor.setDataDirectory(FLANG_TEST_DATA_DIR);
+        if (jit) {
+            visitor.enableJit();
+        }
+        visitor.visitProgram(prog);
+    }
+}
+
+void registerProgramBenchmarks()
+{
+    std::filesystem::path root(FLANG_TEST_DATA_DIR);
+    std::vector<std::filesystem::path> programs;
+    for (auto const& entry : std::filesystem::recursive_directory_iterator(root)) {
+        if (entry.is_regular_file() && entry.path().extension() == ".flang") {
+            programs.push_back(entry.path());
+        }
+    }
+    std::sort(programs.begin(), programs.end());
+    for (auto const& path : programs) {
+        std::ifstream input(path);
+        std::string source {std::istreambuf_iterator<char>(input), std::istreambuf_iterator<char>()};
+        auto name = path.lexically_relative(root).string();
+        benchmark::RegisterBenchmark(("BM_Program/" + name).c_str(), BM_Program, source);
+        benchmark::RegisterBenchmark(("BM_Eval/" + name).c_str(), BM_Eval, source, false);
+        if (jitSupported()) {
+            benchmark::RegisterBenchmark(("BM_EvalJit/" + name).c_str(), BM_Eval, source, true);
+        }
+    }
+}
+
+} // namespace flang::bench
@@ -0,0 +1,56 @@
+#include <benchmark/benchmark.h>
+
+#include "bench_utils.hpp"
+#include "flang/parse/parser.hpp"
+#include "flang/tokenize/tokenizer.hpp"
+
+namespace flang::bench
+{
+
+static void BM_Tokenize(benchmark::State& state)
+{
+    auto source = generateProgram(state.range(0));
+    Tokenizer tokenizer;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(tokenizer.tokenize(source));
+    }
+    state.SetBytesProcessed(state.iterations() * source.size());
+    state.SetComplexityN(state.range(0));
+}
+BENCHMARK(BM_Tokenize)->RangeMultiplier(4)->Range(4, 1024)->Complexity();
+
+static void BM_Parse(benchmark::State& state)
+{
+    auto tokens = Tokenizer().tokenize(generateProgram(state.range(0)));
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(parse(tokens));
+    }
+    state.SetItemsProcessed(state.iterations() * tokens.size());
+    state.SetComplexityN(state.range(0));
+}
+BENCHMARK(BM_Parse)->RangeMultiplier(4)->Range(4, 1024)->Complexity();
+
+// Tokenize and parse a large source split across threads
+static void BM_ParseSource(benchmark::State& state)
+{
+    auto source = generateProgram(20000);
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(parseSource(source, state.range(0)));
+    }
+    state.SetBytesProcessed(state.iterations() * source.size());
+}
+BENCHMARK(BM_ParseSource)->RangeMultiplier(2)->Range(1, 8)->Unit(benchmark::kMillisecond)->UseRealTime();
+
+// Function bodies are left unparsed until called
+static void BM_ParseLazily(benchmark::State& state)
+{
+    auto source = std::make_shared<std::string const>(generateProgram(state.range(0)));
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(parseLazily(source));
+    }
+    state.SetBytesProcessed(state.iterations() * source->size());
+    state.SetComplexityN(state.range(0));
+}
+BENCHMARK(BM_ParseLazily)->RangeMultiplier(4)->Range(4, 1024)->Complexity();
+
+} // namespace flang::bench
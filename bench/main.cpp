@@ -0,0 +1,18 @@
+#include <benchmark/benchmark.h>
+
+namespace flang::bench
+{
+void registerProgramBenchmarks();
+}
+
+int main(int argc, char** argv)
+{
+    flang::bench::registerProgramBenchmarks();
+    benchmark::Initialize(&argc, argv);
+    if (benchmark::ReportUnrecognizedArguments(argc, argv)) {
+        return 1;
+    }
+    benchmark::RunSpecifiedBenchmarks();
+    benchmark::Shutdown();
+    return 0;
+}
@@ -0,0 +1,11 @@
+#! /bin/bash
+
+# NOTE: Run from the project root!
+# Usage: bench/run_bench.sh [output.json] [extra google benchmark flags...]
+# Compare two runs with: python3 bench/compare.py base.json new.json
+
+BENCH_BINARY=${BENCH_BINARY:-build/bench/flang-bench}
+OUTPUT=${1:-bench_output.json}
+shift
+
+"$BENCH_BINARY" --benchmark_out="$OUTPUT" --benchmark_out_format=json "$@"
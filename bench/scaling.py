@@ -0,0 +1,164 @@
+"""
+Generates parameterized F-lang workloads, runs each one across a sweep of
+sizes and fits the empirical complexity exponent k of time ~ size^k.
+
+Usage (from the project root):
+    python3 bench/scaling.py [--binary build/src/flang-interpreter]
+                             [--workloads list,depth,globals,macros]
+                             [--repeat 3] [--keep-dir DIR]
+"""
+
+import argparse
+import math
+import statistics
+import subprocess
+import sys
+import tempfile
+import time
+from pathlib import Path
+from typing import Callable, Dict, List, NamedTuple, Sequence, Tuple
+
+
+class Workload(NamedTuple):
+    description: str
+    generate: Callable[[int], str]
+    sizes: Sequence[int]
+
+
+# `seq` evaluates both arguments in the caller's frame, so `setq` inside it
+# updates globals (a `prog` body would get its own frame).
+SEQ = "(func seq (x y) y)\n"
+
+
+def list_workload(n: int) -> str:
+    """Builds a list of length N with cons, then walks it with head/tail."""
+    return (
+        SEQ
+        + f"""
+(setq lst '())
+(setq i 0)
+(while (less i {n})
+    (seq (setq lst (cons i lst)) (setq i (plus i 1))))
+(setq s 0)
+(while (not (isnull lst))
+    (seq (setq s (plus s (head lst))) (setq lst (tail lst))))
+"""
+    )
+
+
+def depth_workload(d: int) -> str:
+    """Non-tail recursion D frames deep, repeated to get measurable times."""
+    return f"""
+(func down (n)
+  (cond (equal n 0)
+    0
+    (plus 1 (down (minus n 1)))))
+(setq i 0)
+(while (less i 20)
+    (setq i (plus i (minus (down {d}) {d - 1}))))
+"""
+
+
+def globals_workload(g: int) -> str:
+    """Defines G globals and reads every one of them back."""
+    defs = "".join(f"(setq g{i} {i})\n" for i in range(g))
+    reads = "".join(f"(assert (equal g{i} {i}))\n" for i in range(g))
+    return defs + reads
+
+
+def macros_workload(m: int) -> str:
+    """M nested macro invocations, each one forcing its argument with eval."""
+    expr = "0"
+    for _ in range(m):
+        expr = f"(inc {expr})"
+    return (
+        SEQ
+        + f"""
+(macro inc (x) (plus 1 (eval x)))
+(setq i 0)
+(while (less i 50)
+    (seq (assert (equal {expr} {m})) (setq i (plus i 1))))
+"""
+    )
+
+
+WORKLOADS: Dict[str, Workload] = {
+    "list": Workload("list length N (cons/tail)", list_workload, [250, 500, 1000, 2000, 4000]),
+    "depth": Workload("recursion depth D", depth_workload, [50, 100, 200, 400, 800]),
+    "globals": Workload("number of globals G", globals_workload, [500, 1000, 2000, 4000, 8000]),
+    "macros": Workload("macro nesting M", macros_workload, [25, 50, 100, 200, 400]),
+}
+
+
+def run_once(binary: Path, program: Path) -> float:
+    start = time.perf_counter()
+    result = subprocess.run([str(binary), str(program)], stdout=subprocess.DEVNULL, stderr=subprocess.PIPE, text=True)
+    elapsed = time.perf_counter() - start
+    if result.returncode != 0:
+        raise RuntimeError(f"{program} failed:\n{result.stderr}")
+    return elapsed
+
+
+def measure(binary: Path, program: Path, repeat: int) -> float:
+    return statistics.median(run_once(binary, program) for _ in range(repeat))
+
+
+def fit_exponent(points: List[Tuple[int, float]]) -> float:
+    """Least squares slope of log(time) over log(size)."""
+    xs = [math.log(size) for size, _ in points]
+    ys = [math.log(t) for _, t in points]
+    mean_x, mean_y = statistics.fmean(xs), statistics.fmean(ys)
+    num = sum((x - mean_x) * (y - mean_y) for x, y in zip(xs, ys))
+    den = sum((x - mean_x) ** 2 for x in xs)
+    return num / den
+
+
+def main() -> int:
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("--binary", type=Path, default=Path("build/src/flang-interpreter"))
+    parser.add_argument("--workloads", default=",".join(WORKLOADS))
+    parser.add_argument("--repeat", type=int, default=3)
+    parser.add_argument("--keep-dir", type=Path, help="write the generated programs here")
+    args = parser.parse_args()
+
+    if not args.binary.is_file():
+        print(f"Interpreter binary not found: {args.binary}", file=sys.stderr)
+        return 1
+
+    if args.keep_dir:
+        args.keep_dir.mkdir(parents=True, exist_ok=True)
+        return run(args, args.keep_dir)
+    with tempfile.TemporaryDirectory(prefix="flang-scaling-") as work_dir:
+        return run(args, Path(work_dir))
+
+
+def run(args: argparse.Namespace, work_dir: Path) -> int:
+    empty = work_dir / "empty.flang"
+    empty.write_text("")
+    startup = measure(args.binary, empty, args.repeat)
+
+    summary = []
+    for name in args.workloads.split(","):
+        workload = WORKLOADS[name]
+        print(f"== {name}: {workload.description}")
+        points = []
+        for size in workload.sizes:
+            program = work_dir / f"{name}_{size}.flang"
+            program.write_text(workload.generate(size))
+            elapsed = measure(args.binary, program, args.repeat)
+            # Interpreter startup does not depend on the size
+            net = max(elapsed - startup, 1e-6)
+            points.append((size, net))
+            print(f"   {size:>8}  {net * 1000:>10.2f} ms")
+        exponent = fit_exponent(points)
+        print(f"   empirical exponent: {exponent:.2f}")
+        summary.append((name, workload.description, exponent))
+
+    print("\n== complexity summary")
+    for name, description, exponent in summary:
+        print(f"   {name:<10} {description:<30} O(n^{exponent:.2f})")
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <iostream>
+#include <memory>
+#include <streambuf>
+#include <string>
+#include <unordered_map>
+
+#include "flang/eval/eval_visitor.hpp"
+#include "flang/eval/runtime_heap.hpp"
+#include "flang/parse/ast.hpp"
+
+namespace flang
+{
+
+// ----- Embedding API -----
+//
+// Parse a script once, then run it many times with different inputs:
+//
+//     PreparedProgram rules(source);
+//     ExecutionContext context;
+//     context.bind("amount", makeInteger(120));
+//     auto verdict = context.run(rules);
+//
+// A PreparedProgram is immutable and may be run by several contexts, also
+// on different threads. A context is one interpreter and must stay on one
+// thread at a time; it keeps its builtins, global table, argument stack
+// and output buffer between runs, so a run itself only allocates the
+// values the script creates.
+
+class PreparedProgram
+{
+public:
+    // Syntax errors are thrown as tokenizer_exception or parser_exception
+    explicit PreparedProgram(std::string const& source);
+
+    Program const& getForms() const
+    {
+        return forms_;
+    }
+
+private:
+    Program forms_;
+};
+
+class ExecutionContext
+{
+public:
+    explicit ExecutionContext(std::streambuf* output = std::cout.rdbuf(), size_t output_buffer_size = DEFAULT_OUTPUT_BUFFER_SIZE);
+
+    ExecutionContext(ExecutionContext const&)            = delete;
+    ExecutionContext& operator=(ExecutionContext const&) = delete;
+
+    // Global variable for the following runs, kept until it is bound again
+    void bind(std::string const& name, std::shared_ptr<Element> value);
+
+    // Globals defined by the previous run are dropped first. Returns the
+    // value of the last form, null for an empty program. Runtime errors are
+    // thrown as flang_runtime_error, the context stays usable
+    std::shared_ptr<Element> run(PreparedProgram const& program);
+
+    // Global variable as the last run left it, nullptr if unbound
+    std::shared_ptr<Element> get(std::string const& name) const;
+
+    // For enabling the JIT or data files
+    EvalVisitor& getVisitor()
+    {
+        return visitor_;
+    }
+
+private:
+    EvalVisitor visitor_;
+    std::unordered_map<std::string, std::shared_ptr<Element>> inputs_;
+};
+
+} // namespace flang
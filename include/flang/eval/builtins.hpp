@@ -1,8 +1,8 @@
 #pragma once
 
-#include <functional>
-#include <map>
+#include <memory>
 #include <string>
+#include <vector>
 
 #include "eval_visitor.hpp"
 
@@ -10,25 +10,73 @@
 namespace flang
 {
 
-using BuiltinImpl = std::function<void(EvalVisitor* visitor, std::vector<std::shared_ptr<Element>> args)>;
+using BuiltinImpl = std::shared_ptr<Element> (*)(EvalVisitor* visitor, Arguments args);
+// Two-argument builtin applied to already evaluated operands
+using BinaryImpl = std::shared_ptr<Element> (*)(EvalVisitor* visitor, std::shared_ptr<Element> const& lhs, std::shared_ptr<Element> const& rhs);
+// Same without type checks, only valid for the operand kinds of its CallSiteEntry
+using QuickImpl = std::shared_ptr<Element> (*)(Element const& lhs, Element const& rhs);
+
+// Specialization of a call site to one builtin and one pair of operand kinds
+struct CallSiteEntry {
+    Builtin const* builtin = nullptr;
+    ElementKind lhs_kind   = ElementKind::Null;
+    ElementKind rhs_kind   = ElementKind::Null;
+    QuickImpl impl         = nullptr;
+};
+
+// Call sites that saw their operand kinds change stay on the generic path
+inline CallSiteEntry const GENERIC_CALL_SITE {};
+
+struct BinaryBuiltin {
+    BuiltinImpl impl;
+    BinaryImpl checked;
+    std::vector<CallSiteEntry> specializations;
+};
+
+// Builtin nodes and implementations. Built once and shared by all
+// interpreters, so call sites specialized by one stay valid in the others
+class BuiltinTable
+{
+public:
+    static BuiltinTable const& instance();
+
+    std::vector<BuiltinImpl> impls;
+    std::vector<std::shared_ptr<Builtin>> builtins;
+    // Indexed like impls, nullptr for builtins that are not binary
+    std::vector<std::unique_ptr<BinaryBuiltin>> binaries;
+
+private:
+    BuiltinTable();
+
+    void registerBuiltin(std::string name, BuiltinImpl impl);
+    void registerBinaryBuiltin(std::string name, BinaryBuiltin binary);
+    void registerAllBuiltins();
+};
 
 class BuiltinsRegistry
 {
 public:
     BuiltinsRegistry(EvalVisitor* visitor)
         : visitor_(visitor)
+        , table_(BuiltinTable::instance())
+    {
+    }
+
+    std::vector<std::shared_ptr<Builtin>> const& getAllBuiltins() const;
+
+    std::shared_ptr<Element> callBuiltin(Builtin const& builtin, Arguments args)
     {
-        registerAllBuiltins();
+        FLANG_STATS(statistics().countBuiltinCall(builtin.getFrameId()));
+        return table_.impls[builtin.getIndex()](visitor_, args);
     }
 
-    std::vector<std::shared_ptr<Builtin>> getAllBuiltins();
-    void callBuiltin(std::shared_ptr<Builtin> builtin, std::vector<std::shared_ptr<Element>> args);
+    // Like callBuiltin, but two-argument builtins specialize `site` on the
+    // operand kinds they observe and skip the type checks afterwards
+    std::shared_ptr<Element> callBuiltinAt(List const& site, Builtin const& builtin, Arguments args);
 
 private:
     EvalVisitor* visitor_;
-    std::map<std::string, BuiltinImpl> registry_;
-
-    void registerAllBuiltins();
+    BuiltinTable const& table_;
 };
 
 
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <string_view>
+
+#include "flang/parse/ast.hpp"
+
+namespace flang
+{
+
+// ----- Bulk data reader -----
+//
+// Loads data files straight into runtime values, bypassing the Tokenizer,
+// the parser and evaluation. Files are memory-mapped and scanned in place:
+// nothing is copied except identifier names, and equal identifiers share
+// one node. Atoms are separated by whitespace, parentheses and quotes.
+// Malformed data raises a flang_runtime_error naming the origin and line.
+
+// All top-level S-expressions of the text, `'x` is read as (quote x)
+std::shared_ptr<List> readSExpressions(std::string_view text, std::string const& origin = "<data>");
+
+// One list per non-empty line with the comma-separated numbers on it,
+// empty fields are null
+std::shared_ptr<List> readCsv(std::string_view text, std::string const& origin = "<data>");
+
+std::shared_ptr<List> readSExpressionFile(std::string const& path);
+std::shared_ptr<List> readCsvFile(std::string const& path);
+
+} // namespace flang
@@ -1,11 +1,13 @@
 #pragma once
 
-#include <list>
-#include <map>
 #include <memory>
 #include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
 
 #include "flang/parse/ast.hpp"
+#include "flang/profile/shadow_stack.hpp"
 
 
 namespace flang
@@ -13,27 +15,52 @@ namespace flang
 
 const int MAX_STACK_SIZE = 1000;
 
+/**
+Dynamically scoped variables.
+Locals of all active frames live in one flat vector (innermost last), so
+entering and leaving a frame only moves indices and reuses storage;
+the global environment is a hash map.
+*/
 class EnvironmentStack
 {
 public:
-    EnvironmentStack()
-        : environment_stack_()
-    {
-        Environment empty_global_map;
-        environment_stack_.push_back(empty_global_map);
-    }
-
     void pushEnvironment();
     void popEnvironment();
 
-    std::shared_ptr<Element> loadVariable(std::string name);
-    void storeVariable(std::string name, std::shared_ptr<Element> element);
+    std::shared_ptr<Element> loadVariable(std::string const& name);
+    void storeVariable(std::string const& name, std::shared_ptr<Element> element);
+    // Global binding regardless of the active frames, nullptr if unbound
+    std::shared_ptr<Element> loadGlobal(std::string const& name) const;
+    // Unbinds the name if `element` is nullptr
+    void storeGlobal(std::string const& name, std::shared_ptr<Element> element);
+    // restoreGlobals() returns the globals to their state at saveGlobals(),
+    // later globals stay in the map unbound so rebinding them doesn't allocate
+    void saveGlobals();
+    void restoreGlobals();
+    // Bound names and the values loadVariable would return for them
+    std::vector<std::pair<std::string, std::shared_ptr<Element>>> visibleBindings() const;
 
     void throwRuntimeError(std::string message);
 
+    // Number of active non-global frames
+    size_t depth() const
+    {
+        return frames_.size();
+    }
+
 private:
-    using Environment = std::map<std::string, std::shared_ptr<Element>>;
-    std::list<Environment> environment_stack_;
+    struct Binding {
+        std::string name;
+        std::shared_ptr<Element> value;
+    };
+
+    std::vector<Binding> bindings_;
+    // Index in bindings_ where each non-global frame starts
+    std::vector<size_t> frames_;
+    std::unordered_map<std::string, std::shared_ptr<Element>> globals_;
+    std::unordered_map<std::string, std::shared_ptr<Element>> saved_globals_;
+
+    size_t framesWalked(size_t binding_index) const;
 };
 
 class ScopedEnvironment
@@ -41,16 +68,29 @@ class ScopedEnvironment
 public:
     ScopedEnvironment(EnvironmentStack& environment_stack)
         : environment_stack_(environment_stack)
+        , shadow_stack_(nullptr)
+    {
+        environment_stack_.pushEnvironment();
+    }
+    // Call frame of a user function: also tracked on the shadow stack
+    ScopedEnvironment(EnvironmentStack& environment_stack, ShadowStack& shadow_stack, FrameId frame)
+        : environment_stack_(environment_stack)
+        , shadow_stack_(&shadow_stack)
     {
         environment_stack_.pushEnvironment();
+        shadow_stack_->push(frame);
     }
     ~ScopedEnvironment()
     {
+        if (shadow_stack_) {
+            shadow_stack_->pop();
+        }
         environment_stack_.popEnvironment();
     }
 
 private:
     EnvironmentStack& environment_stack_;
+    ShadowStack* shadow_stack_;
 };
 
 } // namespace flang
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <unordered_map>
+
+#include "flang/parse/ast.hpp"
+
+namespace flang
+{
+
+// ----- Cache of evaluated code -----
+//
+// Code that `eval` receives is usually built at runtime, so each evaluation
+// would start with fresh lists: call sites that are not specialized yet (see
+// BuiltinsRegistry::callBuiltinAt) and structural hashes that are not
+// computed yet. The cache maps a form to the first one of the same structure
+// it saw and eval runs that one instead, with everything the earlier runs
+// left on its lists. Forms are matched exactly: the same kinds, atoms equal
+// as in elementsEqual and functions, hash maps and sequences by identity.
+// The least recently used form is dropped once `capacity` are kept.
+
+class EvalCache
+{
+public:
+    static const size_t DEFAULT_CAPACITY = 256;
+
+    explicit EvalCache(size_t capacity = DEFAULT_CAPACITY)
+        : capacity_(capacity)
+    {
+    }
+
+    // The kept form of the same structure as `form`, which is kept if there
+    // is none. Atoms and empty lists are returned as they are
+    std::shared_ptr<Element> canonical(std::shared_ptr<Element> const& form);
+
+    // 0 turns the cache off
+    void setCapacity(size_t capacity);
+
+    size_t size() const
+    {
+        return forms_.size();
+    }
+    uint64_t hits() const
+    {
+        return hits_;
+    }
+    uint64_t misses() const
+    {
+        return misses_;
+    }
+    uint64_t evictions() const
+    {
+        return evictions_;
+    }
+
+private:
+    using FormList = std::list<std::shared_ptr<List>>;
+
+    size_t capacity_;
+    // Most recently used first
+    FormList forms_;
+    std::unordered_multimap<size_t, FormList::iterator> by_hash_;
+    uint64_t hits_      = 0;
+    uint64_t misses_    = 0;
+    uint64_t evictions_ = 0;
+
+    void evict();
+};
+
+} // namespace flang
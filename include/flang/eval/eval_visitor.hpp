@@ -1,58 +1,141 @@
 #pragma once
 
 #include "environment_stack.hpp"
+#include "eval_cache.hpp"
 #include <flang/eval/builtins.hpp>
+#include <flang/eval/runtime_heap.hpp>
 #include <flang/parse/ast.hpp>
+#include <flang/pp/output_sink.hpp>
+#include <functional>
+#include <iostream>
+#include <limits>
 #include <memory>
 #include <string>
+#include <unordered_map>
+#include <utility>
 #include <vector>
 
 namespace flang
 {
 class BuiltinsRegistry;
 
-class EvalVisitor : public Visitor
+// What another interpreter needs to evaluate code like this one at the
+// point the snapshot is taken: the visible bindings and the settings
+struct ContextSnapshot {
+    std::vector<std::pair<std::string, std::shared_ptr<Element>>> bindings;
+    bool jit_enabled = false;
+    std::unordered_map<std::string, std::string> data_files;
+    std::string data_directory;
+};
+
+class EvalVisitor final : public ValueVisitor<std::shared_ptr<Element>>
 {
 public:
-    EvalVisitor()
-        : builtin_registry_(std::make_shared<BuiltinsRegistry>(this))
+    explicit EvalVisitor(size_t output_buffer_size = DEFAULT_OUTPUT_BUFFER_SIZE, std::streambuf* output = std::cout.rdbuf())
+        : output_sink_(output, output_buffer_size)
+        , output_(&output_sink_)
+        , builtin_registry_(std::make_shared<BuiltinsRegistry>(this))
     {
         setAllBuiltins();
     }
+    // Starts with the bindings of the snapshot as globals
+    EvalVisitor(ContextSnapshot const& snapshot, std::streambuf* output);
 
-    std::shared_ptr<Element> evalElement(std::shared_ptr<Element> node);
-    void visitIdentifier(std::shared_ptr<Identifier> node) override;
-    void visitInteger(std::shared_ptr<Integer> node) override;
-    void visitReal(std::shared_ptr<Real> node) override;
-    void visitBoolean(std::shared_ptr<Boolean> node) override;
-    void visitNull(std::shared_ptr<Null> node) override;
-    void visitList(std::shared_ptr<List> node) override;
-    void visitUserFunction(std::shared_ptr<UserFunction> node) override;
-    void visitBuiltin(std::shared_ptr<Builtin> node) override;
+    void visitProgram(Program program);
+    // Evaluates the forms in order, the value is the one of the last form
+    std::shared_ptr<Element> evalProgram(Program const& program);
+    std::shared_ptr<Element> evalElement(std::shared_ptr<Element> const& node);
+    std::shared_ptr<Element> visitIdentifier(std::shared_ptr<Identifier> node) override;
+    std::shared_ptr<Element> visitInteger(std::shared_ptr<Integer> node) override;
+    std::shared_ptr<Element> visitReal(std::shared_ptr<Real> node) override;
+    std::shared_ptr<Element> visitBoolean(std::shared_ptr<Boolean> node) override;
+    std::shared_ptr<Element> visitNull(std::shared_ptr<Null> node) override;
+    std::shared_ptr<Element> visitList(std::shared_ptr<List> node) override;
+    std::shared_ptr<Element> visitUserFunction(std::shared_ptr<UserFunction> node) override;
+    std::shared_ptr<Element> visitBuiltin(std::shared_ptr<Builtin> node) override;
+    std::shared_ptr<Element> visitHashMap(std::shared_ptr<HashMap> node) override;
+    std::shared_ptr<Element> visitLazyBody(std::shared_ptr<LazyBody> node) override;
+    std::shared_ptr<Element> visitSequence(std::shared_ptr<Sequence> node) override;
+    std::shared_ptr<Element> visitFuture(std::shared_ptr<Future> node) override;
+    std::shared_ptr<Element> visitArray(std::shared_ptr<Array> node) override;
 
     // --- Evaluation State ---
-    void setResult(std::shared_ptr<Element> element);
-    void setNullResult();
+    // Program output, flushed when the visitor is destroyed
+    std::ostream& output();
+    // Run eligible user functions as native code, see jit.hpp
+    void enableJit();
+    // Data files for loadsexp/loadcsv: `name` is read from `path`, other
+    // names from "<data directory>/<name>.<format>"
+    void addDataFile(std::string const& name, std::string path);
+    void setDataDirectory(std::string directory);
+    std::string dataFilePath(std::string const& name, std::string const& extension) const;
+    // Forms evaluated by eval, see eval_cache.hpp
+    EvalCache& evalCache()
+    {
+        return eval_cache_;
+    }
+    // Activated on each thread this visitor evaluates on, see shadow_stack.hpp
+    ShadowStack& shadowStack()
+    {
+        return shadow_stack_;
+    }
+    // Calls `yield` once every `fuel` safe points, see scheduler.hpp
+    void setYieldHook(size_t fuel, std::function<void()> yield);
+    // Passed on function entry and on loop back-edges
+    void safePoint()
+    {
+        if (--fuel_left_ == 0) {
+            refuel();
+        }
+        collectGarbageIfRequested();
+    }
+    // Calls a function value with already evaluated arguments
+    std::shared_ptr<Element> callFunction(std::shared_ptr<Element> const& callee, std::span<std::shared_ptr<Element> const> values);
+    ContextSnapshot snapshotContext() const;
     ScopedEnvironment createScopedEnvironment();
     std::shared_ptr<Element> loadVariable(std::string const& name);
     void storeVariable(std::string const& name, std::shared_ptr<Element> element);
+    // See EnvironmentStack::loadGlobal, storeGlobal, saveGlobals and restoreGlobals
+    std::shared_ptr<Element> loadGlobal(std::string const& name) const;
+    void storeGlobal(std::string const& name, std::shared_ptr<Element> element);
+    void saveGlobals();
+    void restoreGlobals();
     void throwRuntimeError(std::string const& message);
 
     // --- Requires ---
-    std::shared_ptr<Integer> requireInteger(std::shared_ptr<Element> element);
-    std::shared_ptr<Real> requireReal(std::shared_ptr<Real> element);
-    std::shared_ptr<Boolean> requireBoolean(std::shared_ptr<Element> element);
-    std::shared_ptr<List> requireList(std::shared_ptr<Element> element);
-    std::shared_ptr<Identifier> requireIdentifier(std::shared_ptr<Element> element);
-    void requireArgsNumber(std::vector<std::shared_ptr<Element>> args, int n);
+    std::shared_ptr<Integer> requireInteger(std::shared_ptr<Element> const& element);
+    std::shared_ptr<Real> requireReal(std::shared_ptr<Element> const& element);
+    std::shared_ptr<Boolean> requireBoolean(std::shared_ptr<Element> const& element);
+    std::shared_ptr<List> requireList(std::shared_ptr<Element> const& element);
+    std::shared_ptr<Identifier> requireIdentifier(std::shared_ptr<Element> const& element);
+    std::shared_ptr<HashMap> requireHashMap(std::shared_ptr<Element> const& element);
+    std::shared_ptr<Array> requireArray(std::shared_ptr<Element> const& element);
+    void requireArgsNumber(Arguments args, size_t n);
 
 private:
+    // First, so the collector waits until the other members are gone
+    HeapMutator heap_mutator_;
     EnvironmentStack env_;
-    std::shared_ptr<Element> result_;
+    ShadowStack shadow_stack_;
+    OutputSink output_sink_;
+    std::ostream output_;
+    // Evaluated arguments of the calls in progress
+    std::vector<std::shared_ptr<Element>> arg_stack_;
     std::shared_ptr<BuiltinsRegistry> builtin_registry_;
+    EvalCache eval_cache_;
+    bool jit_enabled_ = false;
+    std::unordered_map<std::string, std::string> data_files_;
+    std::string data_directory_ = ".";
+    size_t fuel_                = 0;
+    size_t fuel_left_           = std::numeric_limits<size_t>::max();
+    std::function<void()> yield_;
 
     void setAllBuiltins();
+    void refuel();
 
-    void callUserFunc(std::shared_ptr<UserFunction> fn, std::vector<std::shared_ptr<Element>> args);
+    void checkArity(UserFunction const& fn, size_t n_args);
+    std::shared_ptr<Element> callUserFunc(std::shared_ptr<UserFunction> const& fn, Arguments args);
+    // Runs `fn` with the argument values on arg_stack_ from `args_base` on
+    std::shared_ptr<Element> enterUserFunc(std::shared_ptr<UserFunction> const& fn, size_t args_base);
 };
 } // namespace flang
@@ -0,0 +1,111 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "flang/eval/eval_visitor.hpp"
+#include "flang/parse/ast.hpp"
+
+namespace flang
+{
+
+// ----- Futures -----
+//
+// (future expr) returns a Future whose value is expr evaluated on another
+// thread, (touch f) waits for it. The expression runs in an interpreter of
+// its own that starts from a snapshot of the bindings visible at the
+// future, so its setq stay with it. Its output is printed by the first
+// touch, and an error in it is thrown by every touch.
+//
+// Each worker thread owns a deque of tasks: futures it creates are pushed
+// and popped at the back, and an idle worker steals the oldest task from
+// the front of another deque. Futures created outside the workers go to a
+// deque of their own. When there are not more idle workers than queued
+// tasks, future evaluates the expression right away on the calling thread,
+// so a deep recursion only hands off as many subexpressions as there are
+// workers to take them. A thread waiting in touch runs the task itself if
+// nobody took it yet, and other queued tasks while it waits.
+//
+// Hash maps and arrays shared by the caller and the expression must not be
+// changed by both. Sequences may be pulled by both.
+
+struct FutureTask {
+    enum State { Queued, Running, Done };
+
+    std::shared_ptr<Element> expression;
+    ContextSnapshot snapshot;
+    std::atomic<State> state {Queued};
+
+    std::mutex mutex;
+    std::condition_variable done_cv;
+    std::shared_ptr<Element> value;
+    std::exception_ptr error;
+    std::string output;
+    bool output_printed = false;
+};
+
+class FuturePool
+{
+public:
+    static FuturePool& instance();
+
+    ~FuturePool();
+
+    FuturePool(FuturePool const&)            = delete;
+    FuturePool& operator=(FuturePool const&) = delete;
+
+    // Threads evaluating futures, counting the one that touches them, so
+    // n - 1 workers are started. Must not be called while a future is not
+    // touched yet
+    void setThreads(size_t n);
+    // Waits for the tasks that are running and joins the workers, queued
+    // tasks are dropped. Must be called before returning from main: the
+    // workers use statics that may be destroyed before the pool
+    void shutdown();
+
+    std::shared_ptr<Future> submit(EvalVisitor& visitor, std::shared_ptr<Element> expression);
+    std::shared_ptr<Element> touch(EvalVisitor& visitor, Future const& future);
+
+private:
+    using TaskDeque = std::deque<std::shared_ptr<FutureTask>>;
+
+    struct Worker {
+        std::mutex mutex;
+        TaskDeque tasks;
+    };
+
+    FuturePool();
+
+    size_t n_threads_;
+    // Workers are started by the first future
+    std::mutex start_mutex_;
+    std::atomic<bool> started_ {false};
+    // One per worker thread and, last, the one of all other threads
+    std::vector<std::unique_ptr<Worker>> deques_;
+    std::vector<std::thread> threads_;
+    std::atomic<size_t> idle_ {0};
+    std::atomic<size_t> queued_ {0};
+
+    std::mutex sleep_mutex_;
+    std::condition_variable work_cv_;
+    std::atomic<bool> stopping_ {false};
+
+    void start();
+    void stop();
+    void workerLoop(size_t index);
+    // A queued task claimed for the calling thread, nullptr if there is none
+    std::shared_ptr<FutureTask> findTask();
+    bool claim(FutureTask& task);
+    void run(FutureTask& task);
+    void runInline(EvalVisitor& visitor, FutureTask& task);
+};
+
+} // namespace flang
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "flang/parse/ast.hpp"
+
+namespace flang
+{
+class EvalVisitor;
+
+// ----- Incremental re-evaluation -----
+//
+// Keeps the top-level forms of an evaluated program and, given an edited
+// version of it, evaluates only the forms that changed and the forms that
+// depend on them. Forms are matched by their structural hash, in order.
+// A form depends on an earlier one if it reads a global name the earlier one
+// writes with setq, func or macro, directly or through the bodies of the
+// functions it calls. Before a form is evaluated the globals are reset to
+// their values at that point of the program. Forms calling eval or a macro
+// may touch any name, so all forms after them are evaluated as well.
+// A top-level mapset, mapdel or aset writes the hash map or array it
+// changes; when such a form is evaluated again or removed, the forms writing
+// that name are evaluated again from the one that created the value.
+
+struct UpdateReport {
+    size_t forms     = 0;
+    size_t evaluated = 0;
+};
+
+class IncrementalProgram
+{
+public:
+    explicit IncrementalProgram(EvalVisitor& visitor);
+    ~IncrementalProgram();
+
+    IncrementalProgram(IncrementalProgram const&)            = delete;
+    IncrementalProgram& operator=(IncrementalProgram const&) = delete;
+
+    // The first update evaluates every form. An error stops the update, the
+    // failed form and the ones after it are evaluated on the next update
+    UpdateReport update(Program program);
+
+private:
+    struct Form;
+
+    EvalVisitor& visitor_;
+    std::vector<Form> forms_;
+    // Values of the written globals before the first form, nullptr if unbound
+    std::unordered_map<std::string, std::shared_ptr<Element>> initial_globals_;
+};
+
+} // namespace flang
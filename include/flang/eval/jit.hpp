@@ -0,0 +1,42 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "environment_stack.hpp"
+#include "flang/parse/ast.hpp"
+
+namespace flang
+{
+
+// ----- Baseline JIT -----
+//
+// User functions whose bodies only combine integer arguments with integer
+// and boolean builtins (plus, less, cond, ...) and calls to other such
+// functions are translated to x86-64 machine code on their first call.
+// The generated code has no side effects, so on integer overflow, division
+// by zero or deep recursion it simply abandons the call, and the call is
+// evaluated again by the interpreter.
+
+const size_t MAX_JIT_ARGS = 16;
+
+struct JitEntry {
+    // nullptr if the function cannot be compiled
+    void const* code     = nullptr;
+    bool returns_boolean = false;
+    // Names the code was specialized for and the values they resolved to,
+    // checked on every call from the interpreter
+    std::vector<std::pair<std::string, std::shared_ptr<Element>>> guards;
+    // Formal arguments of this function and of everything it calls
+    std::vector<std::string> bound_names;
+};
+
+bool jitSupported();
+
+// Runs `fn` as native code when possible, nullptr means the call has to be
+// interpreted. `args` are the evaluated arguments
+std::shared_ptr<Element> jitCall(EnvironmentStack& env, std::shared_ptr<UserFunction> const& fn, Arguments args);
+
+} // namespace flang
@@ -0,0 +1,163 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <type_traits>
+#include <vector>
+
+#include "flang/parse/ast.hpp"
+
+namespace flang
+{
+
+// ----- Runtime heap -----
+//
+// Values produced during evaluation are allocated from size-segregated,
+// thread-local free lists instead of the general purpose allocator.
+// Immutable atoms that are cheap to share (booleans, null and small
+// integers) are interned, so producing them costs no allocation at all.
+//
+// Values are reference counted, which frees everything but cycles. Only
+// hash maps and arrays can be changed after they are made, so every cycle
+// passes through one of them: they are tracked, and a mark-sweep collector
+// finds the ones no longer reachable. Its roots are the references from
+// outside the traced values (the environment stacks, the argument stacks
+// and temporaries of the evaluators, pending futures): for each value
+// reached from a tracked one, the references from other traced values are
+// subtracted from its reference count, and what is left over comes from a
+// root. Lists, hash maps, arrays and the values of finished futures are
+// traced; code, functions and sequences are not, so a cycle through them
+// is kept. Unreachable hash maps and arrays are emptied, which breaks the
+// cycles and lets the reference counts free them.
+//
+// An evaluator asks for a collection once enough containers have been made
+// since the last one, and it runs at the next call or loop iteration.
+// Reference counts change under the collector while another evaluator runs,
+// so collections are skipped while there is more than one.
+
+void* heapAllocate(size_t size);
+void heapDeallocate(void* pointer, size_t size);
+
+struct HeapStatistics {
+    // Memory obtained from the system for the pools
+    uint64_t reserved_bytes;
+    // Blocks currently handed out / the maximum ever handed out
+    uint64_t live_bytes;
+    uint64_t peak_live_bytes;
+    uint64_t allocations;
+    // Hash maps and arrays known to the collector
+    uint64_t tracked_containers;
+    uint64_t collections;
+    uint64_t collected_containers;
+    uint64_t total_pause_ns;
+    uint64_t max_pause_ns;
+};
+
+HeapStatistics heapStatistics();
+
+template <class T>
+class RuntimeAllocator
+{
+public:
+    using value_type = T;
+
+    RuntimeAllocator() = default;
+
+    template <class U>
+    RuntimeAllocator(RuntimeAllocator<U> const&)
+    {
+    }
+
+    T* allocate(size_t n)
+    {
+        return static_cast<T*>(heapAllocate(n * sizeof(T)));
+    }
+
+    void deallocate(T* pointer, size_t n)
+    {
+        heapDeallocate(pointer, n * sizeof(T));
+    }
+
+    template <class U>
+    bool operator==(RuntimeAllocator<U> const&) const
+    {
+        return true;
+    }
+};
+
+// Registers an evaluator with the collector for its lifetime
+class HeapMutator
+{
+public:
+    HeapMutator();
+    ~HeapMutator();
+
+    HeapMutator(HeapMutator const&)            = delete;
+    HeapMutator& operator=(HeapMutator const&) = delete;
+};
+
+void trackContainer(std::shared_ptr<Element> const& container);
+
+// Called by an evaluator. Does nothing while other evaluators exist
+void collectGarbage();
+
+inline std::atomic<bool> collection_requested {false};
+
+inline void collectGarbageIfRequested()
+{
+    if (collection_requested.load(std::memory_order_relaxed)) {
+        collectGarbage();
+    }
+}
+
+template <class T, class... Args>
+std::shared_ptr<T> allocateValue(Args&&... args)
+{
+    auto value = std::allocate_shared<T>(RuntimeAllocator<T>(), std::forward<Args>(args)...);
+    if constexpr (std::is_same_v<T, HashMap> || std::is_same_v<T, Array>) {
+        trackContainer(value);
+    }
+    return value;
+}
+
+const Integer::internal_type_t MIN_INTERNED_INTEGER = -128;
+const Integer::internal_type_t MAX_INTERNED_INTEGER = 1023;
+
+struct InternedValues {
+    std::shared_ptr<Boolean> true_value;
+    std::shared_ptr<Boolean> false_value;
+    std::shared_ptr<Null> null_value;
+    std::vector<std::shared_ptr<Integer>> small_integers;
+
+    InternedValues();
+};
+
+extern InternedValues const interned_values;
+
+inline std::shared_ptr<Integer> makeInteger(Integer::internal_type_t value)
+{
+    if (value >= MIN_INTERNED_INTEGER && value <= MAX_INTERNED_INTEGER) {
+        return interned_values.small_integers[value - MIN_INTERNED_INTEGER];
+    }
+    return allocateValue<Integer>(value);
+}
+
+inline std::shared_ptr<Boolean> makeBoolean(bool value)
+{
+    return value ? interned_values.true_value : interned_values.false_value;
+}
+
+inline std::shared_ptr<Null> makeNull()
+{
+    return interned_values.null_value;
+}
+
+inline std::shared_ptr<List> makeList(std::vector<std::shared_ptr<Element>> elements)
+{
+    return allocateValue<List>(std::move(elements));
+}
+
+} // namespace flang
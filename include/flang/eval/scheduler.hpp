@@ -0,0 +1,82 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <streambuf>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "flang/parse/ast.hpp"
+
+namespace flang
+{
+
+// ----- Cooperative scheduler -----
+//
+// Runs many programs on a few threads. Every program gets its own evaluator
+// running on a separate stack (a ucontext fiber). Once it has passed `fuel`
+// safe points (function entries and loop back-edges, see
+// EvalVisitor::safePoint) it is suspended and queued behind the other
+// programs, and the thread resumes the next one. Native code from the JIT
+// runs to completion without safe points.
+
+const size_t DEFAULT_SCRIPT_FUEL      = 10000;
+const size_t DEFAULT_FIBER_STACK_SIZE = 8 << 20;
+
+struct ScriptReport {
+    std::string name;
+    // Thread CPU time spent in the script's time slices
+    std::chrono::nanoseconds cpu_time {0};
+    size_t slices = 0;
+    // Message of the error that stopped the script, empty on success
+    std::string error;
+};
+
+class Scheduler
+{
+public:
+    explicit Scheduler(size_t n_threads = std::thread::hardware_concurrency(), size_t fuel = DEFAULT_SCRIPT_FUEL);
+    ~Scheduler();
+
+    Scheduler(Scheduler const&)            = delete;
+    Scheduler& operator=(Scheduler const&) = delete;
+
+    void enableJit();
+    // Data file for every program, see EvalVisitor::addDataFile
+    void addDataFile(std::string const& name, std::string path);
+
+    // `output` receives the program output unbuffered and must outlive run()
+    void submit(std::string name, Program program, std::streambuf* output, std::string data_directory = ".");
+
+    // Runs the submitted programs to completion, reports are in submission order
+    std::vector<ScriptReport> run();
+
+private:
+    struct Script;
+
+    size_t n_threads_;
+    size_t fuel_;
+    bool jit_enabled_ = false;
+    std::vector<std::pair<std::string, std::string>> data_files_;
+    std::vector<std::unique_ptr<Script>> scripts_;
+
+    std::mutex mutex_;
+    std::condition_variable ready_cv_;
+    std::deque<Script*> ready_;
+    size_t unfinished_ = 0;
+
+    Script* takeReady();
+    void finishSlice(Script* script);
+    void workerLoop();
+};
+
+void printScriptReports(std::ostream& os, std::vector<ScriptReport> const& reports);
+
+} // namespace flang
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <optional>
+
+#include "flang/parse/ast.hpp"
+
+namespace flang
+{
+class EvalVisitor;
+
+// ----- Lazy sequences -----
+//
+// A Sequence is a source (a list or a range of integers) and a pipeline of
+// map, filter and take stages. Adding a stage to a sequence copies the
+// pipeline instead of producing the elements, and pulling an element runs
+// it from the source through all stages before the next one is touched.
+// Streaming over a sequence holds one element at a time however long it
+// is. Stage functions are expected to be pure: a sequence and the ones
+// derived from it pull their elements separately.
+
+// Integers from `start` by `step`, without an `end` the sequence is infinite
+std::shared_ptr<Sequence> makeRange(int64_t start, std::optional<int64_t> end, int64_t step);
+
+// `source` is a Sequence or a List
+std::shared_ptr<Sequence> addSequenceStage(std::shared_ptr<Element> const& source, SequenceStage stage);
+
+// The sequence without its first element, empty if there is none
+std::shared_ptr<Sequence> sequenceRest(EvalVisitor& visitor, Sequence const& sequence);
+
+// Pulls the elements in order
+void forEachElement(EvalVisitor& visitor, Sequence const& sequence, std::function<void(std::shared_ptr<Element>)> const& consume);
+
+} // namespace flang
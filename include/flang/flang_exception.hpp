@@ -1,21 +1,34 @@
 #pragma once
 
+#include <memory>
 #include <stdexcept>
 #include <string>
 
 namespace flang
 {
 
+class Element;
+
 
 // ----- Control Flow Exceptions -----
 
 class flang_return : public std::runtime_error
 {
 public:
-    explicit flang_return()
+    explicit flang_return(std::shared_ptr<Element> value)
         : std::runtime_error("")
+        , value_(std::move(value))
     {
     }
+
+    // Value of the `return` expression, moved out by the catching call
+    std::shared_ptr<Element>& value()
+    {
+        return value_;
+    }
+
+private:
+    std::shared_ptr<Element> value_;
 };
 
 class flang_break : public std::runtime_error
@@ -1,10 +1,20 @@
 #pragma once
 
+#include <atomic>
+#include <cstdint>
 #include <functional>
 #include <memory>
+#include <mutex>
+#include <span>
 #include <string>
+#include <string_view>
+#include <unordered_map>
 #include <vector>
 
+#include "element_kind.hpp"
+#include "flang/profile/shadow_stack.hpp"
+#include "flang/profile/stats.hpp"
+
 namespace flang
 {
 
@@ -17,13 +27,22 @@ class Null;
 class List;
 class UserFunction;
 class Builtin;
+class HashMap;
+class LazyBody;
+class Sequence;
+class Future;
+class Array;
 
 using Program = std::vector<std::shared_ptr<Element>>;
+// Non-owning view of the unevaluated arguments at a call site
+using Arguments = std::span<std::shared_ptr<Element> const>;
 
 class Visitor
 {
 public:
     virtual void visitProgram(Program program);
+    // Dispatches on the kind tag of the node
+    void visitElement(std::shared_ptr<Element> const& node);
     virtual void visitIdentifier(std::shared_ptr<Identifier> node)     = 0;
     virtual void visitInteger(std::shared_ptr<Integer> node)           = 0;
     virtual void visitReal(std::shared_ptr<Real> node)                 = 0;
@@ -32,40 +51,95 @@ public:
     virtual void visitList(std::shared_ptr<List> node)                 = 0;
     virtual void visitUserFunction(std::shared_ptr<UserFunction> node) = 0;
     virtual void visitBuiltin(std::shared_ptr<Builtin> node)           = 0;
+    virtual void visitHashMap(std::shared_ptr<HashMap> node)           = 0;
+    virtual void visitLazyBody(std::shared_ptr<LazyBody> node)         = 0;
+    virtual void visitSequence(std::shared_ptr<Sequence> node)         = 0;
+    virtual void visitFuture(std::shared_ptr<Future> node)             = 0;
+    virtual void visitArray(std::shared_ptr<Array> node)               = 0;
+};
+
+// Visitor whose visit methods hand their result back to the caller
+template <class Result>
+class ValueVisitor
+{
+public:
+    virtual ~ValueVisitor() = default;
+
+    // Dispatches on the kind tag of the node
+    Result visitElement(std::shared_ptr<Element> const& node);
+    virtual Result visitIdentifier(std::shared_ptr<Identifier> node)     = 0;
+    virtual Result visitInteger(std::shared_ptr<Integer> node)           = 0;
+    virtual Result visitReal(std::shared_ptr<Real> node)                 = 0;
+    virtual Result visitBoolean(std::shared_ptr<Boolean> node)           = 0;
+    virtual Result visitNull(std::shared_ptr<Null> node)                 = 0;
+    virtual Result visitList(std::shared_ptr<List> node)                 = 0;
+    virtual Result visitUserFunction(std::shared_ptr<UserFunction> node) = 0;
+    virtual Result visitBuiltin(std::shared_ptr<Builtin> node)           = 0;
+    virtual Result visitHashMap(std::shared_ptr<HashMap> node)           = 0;
+    virtual Result visitLazyBody(std::shared_ptr<LazyBody> node)         = 0;
+    virtual Result visitSequence(std::shared_ptr<Sequence> node)         = 0;
+    virtual Result visitFuture(std::shared_ptr<Future> node)             = 0;
+    virtual Result visitArray(std::shared_ptr<Array> node)               = 0;
 };
 
 class EvalVisitor;
+struct JitEntry;
+struct FutureTask;
+struct CallSiteEntry;
 
 class Element
 {
 public:
+    explicit Element(ElementKind kind)
+        : kind_(kind)
+    {
+        FLANG_STATS(statistics().countAllocation(kind));
+    }
+
     virtual ~Element() = default;
 
-    virtual void accept(Visitor& visitor) = 0;
+    ElementKind kind() const
+    {
+        return kind_;
+    }
 
 private:
+    ElementKind kind_;
     // TODO: Location
 };
 
-class Identifier : public Element, public std::enable_shared_from_this<Identifier>
+template <class T>
+bool isa(Element const& element)
+{
+    return element.kind() == T::KIND;
+}
+
+// Checked downcast: nullptr if the element is not a T
+template <class T>
+std::shared_ptr<T> elementCast(std::shared_ptr<Element> const& element)
+{
+    if (element && isa<T>(*element)) {
+        return std::static_pointer_cast<T>(element);
+    }
+    return nullptr;
+}
+
+class Identifier : public Element
 {
 public:
+    static constexpr ElementKind KIND = ElementKind::Identifier;
+
     explicit Identifier(std::string name)
-        : name_(std::move(name))
+        : Element(KIND)
+        , name_(std::move(name))
     {
     }
 
-    std::string getName() const
+    std::string const& getName() const
     {
         return name_;
     }
 
-    void accept(Visitor& visitor) override
-    {
-        visitor.visitIdentifier(shared_from_this());
-    }
-
-
 private:
     std::string name_;
 };
@@ -73,16 +147,24 @@ private:
 class Literal : public Element
 {
 public:
+    explicit Literal(ElementKind kind)
+        : Element(kind)
+    {
+    }
+
     virtual ~Literal() = default;
 };
 
-class Integer final : public Literal, public std::enable_shared_from_this<Integer>
+class Integer final : public Literal
 {
 public:
+    static constexpr ElementKind KIND = ElementKind::Integer;
+
     using internal_type_t = int64_t;
 
     explicit Integer(int64_t value)
-        : value_(value)
+        : Literal(KIND)
+        , value_(value)
     {
     }
 
@@ -91,22 +173,20 @@ public:
         return value_;
     }
 
-    void accept(Visitor& visitor) override
-    {
-        visitor.visitInteger(shared_from_this());
-    }
-
 private:
     internal_type_t value_;
 };
 
-class Real final : public Literal, public std::enable_shared_from_this<Real>
+class Real final : public Literal
 {
 public:
+    static constexpr ElementKind KIND = ElementKind::Real;
+
     using internal_type_t = double;
 
     explicit Real(double value)
-        : value_(value)
+        : Literal(KIND)
+        , value_(value)
     {
     }
 
@@ -115,22 +195,20 @@ public:
         return value_;
     }
 
-    void accept(Visitor& visitor) override
-    {
-        visitor.visitReal(shared_from_this());
-    }
-
 private:
     internal_type_t value_;
 };
 
-class Boolean final : public Literal, public std::enable_shared_from_this<Boolean>
+class Boolean final : public Literal
 {
 public:
+    static constexpr ElementKind KIND = ElementKind::Boolean;
+
     using internal_type_t = bool;
 
     explicit Boolean(bool value)
-        : value_(value)
+        : Literal(KIND)
+        , value_(value)
     {
     }
 
@@ -139,28 +217,29 @@ public:
         return value_;
     }
 
-    void accept(Visitor& visitor) override
-    {
-        visitor.visitBoolean(shared_from_this());
-    }
-
 private:
     internal_type_t value_;
 };
 
-class Null final : public Literal, public std::enable_shared_from_this<Null>
+class Null final : public Literal
 {
-    void accept(Visitor& visitor) override
+public:
+    static constexpr ElementKind KIND = ElementKind::Null;
+
+    Null()
+        : Literal(KIND)
     {
-        visitor.visitNull(shared_from_this());
     }
 };
 
-class List final : public Element, public std::enable_shared_from_this<List>
+class List final : public Element
 {
 public:
+    static constexpr ElementKind KIND = ElementKind::List;
+
     explicit List(std::vector<std::shared_ptr<Element>> elements)
-        : elements_(std::move(elements))
+        : Element(KIND)
+        , elements_(std::move(elements))
     {
     }
 
@@ -169,27 +248,76 @@ public:
         return elements_;
     }
 
-    void accept(Visitor& visitor) override
+    // Structural hash, lists are immutable so it is computed once (see equality.cpp)
+    size_t getHash() const;
+
+    // Operand kinds observed when the list is evaluated as a builtin call, see builtins.hpp
+    CallSiteEntry const* getCallSite() const
     {
-        visitor.visitList(shared_from_this());
+        return call_site_.load(std::memory_order_acquire);
+    }
+
+    void setCallSite(CallSiteEntry const* entry) const
+    {
+        call_site_.store(entry, std::memory_order_release);
     }
 
 private:
+    static constexpr size_t NO_HASH = 0;
+
     std::vector<std::shared_ptr<Element>> elements_;
+    mutable std::atomic<size_t> hash_ {NO_HASH};
+    mutable std::atomic<CallSiteEntry const*> call_site_ {nullptr};
+};
+
+// Function body that is kept as source text until the function is first
+// called, see parseLazily in parser.hpp
+class LazyBody final : public Element
+{
+public:
+    static constexpr ElementKind KIND = ElementKind::LazyBody;
+
+    LazyBody(std::shared_ptr<std::string const> source, size_t begin, size_t end, size_t first_line)
+        : Element(KIND)
+        , source_(std::move(source))
+        , begin_(begin)
+        , end_(end)
+        , first_line_(first_line)
+    {
+    }
+
+    std::string_view getSource() const
+    {
+        return std::string_view(*source_).substr(begin_, end_ - begin_);
+    }
+
+    // Tokenizes and parses the body on the first call (defined in parser.cpp)
+    std::shared_ptr<Element> const& force() const;
+
+private:
+    std::shared_ptr<std::string const> source_;
+    size_t begin_;
+    size_t end_;
+    size_t first_line_;
+    mutable std::once_flag parsed_;
+    mutable std::shared_ptr<Element> body_;
 };
 
-class UserFunction final : public Element, public std::enable_shared_from_this<UserFunction>
+class UserFunction final : public Element
 {
 public:
+    static constexpr ElementKind KIND = ElementKind::UserFunction;
+
     UserFunction(std::string name, std::vector<std::string> formal_args, std::shared_ptr<Element> body, bool is_macro = false)
-        : name_(name)
+        : Element(KIND)
+        , name_(name)
         , formal_args_(formal_args)
         , body_(body)
         , is_macro_(is_macro)
     {
     }
 
-    std::string getName() const
+    std::string const& getName() const
     {
         return name_;
     }
@@ -199,8 +327,11 @@ public:
         return formal_args_;
     }
 
-    std::shared_ptr<Element> getBody() const
+    std::shared_ptr<Element> const& getBody() const
     {
+        if (isa<LazyBody>(*body_)) {
+            return static_cast<LazyBody const&>(*body_).force();
+        }
         return body_;
     }
 
@@ -209,9 +340,25 @@ public:
         return is_macro_;
     }
 
-    void accept(Visitor& visitor) override
+    FrameId getFrameId() const
     {
-        visitor.visitUserFunction(shared_from_this());
+        auto id = frame_id_.load(std::memory_order_relaxed);
+        if (id == NO_FRAME) {
+            id = internFrameName(name_);
+            frame_id_.store(id, std::memory_order_relaxed);
+        }
+        return id;
+    }
+
+    // Native code for the function, see jit.hpp
+    JitEntry const* getJitEntry() const
+    {
+        return jit_entry_.load(std::memory_order_acquire);
+    }
+
+    void setJitEntry(JitEntry const* entry) const
+    {
+        jit_entry_.store(entry, std::memory_order_release);
     }
 
 private:
@@ -219,30 +366,235 @@ private:
     std::vector<std::string> formal_args_;
     std::shared_ptr<Element> body_;
     bool is_macro_;
+    mutable std::atomic<FrameId> frame_id_ {NO_FRAME};
+    mutable std::atomic<JitEntry const*> jit_entry_ {nullptr};
 };
 
-class Builtin final : public Element, public std::enable_shared_from_this<Builtin>
+class Builtin final : public Element
 {
 public:
-    explicit Builtin(std::string name)
-        : name_(name)
+    static constexpr ElementKind KIND = ElementKind::Builtin;
+
+    Builtin(std::string name, size_t index)
+        : Element(KIND)
+        , name_(name)
+        , index_(index)
+    {
+    }
+
+    // Position of the implementation in the BuiltinsRegistry
+    size_t getIndex() const
     {
+        return index_;
     }
 
-    std::string getName() const
+    std::string const& getName() const
     {
         return name_;
     }
 
-    void accept(Visitor& visitor) override
+    FrameId getFrameId() const
     {
-        visitor.visitBuiltin(shared_from_this());
+        auto id = frame_id_.load(std::memory_order_relaxed);
+        if (id == NO_FRAME) {
+            id = internFrameName(name_);
+            frame_id_.store(id, std::memory_order_relaxed);
+        }
+        return id;
     }
 
 private:
     std::string name_;
+    size_t index_;
+    mutable std::atomic<FrameId> frame_id_ {NO_FRAME};
+};
+
+// Mutable map, keys are compared structurally (see equality.hpp)
+class HashMap final : public Element
+{
+public:
+    static constexpr ElementKind KIND = ElementKind::HashMap;
+
+    struct KeyHash {
+        size_t operator()(std::shared_ptr<Element> const& key) const;
+    };
+    struct KeyEqual {
+        bool operator()(std::shared_ptr<Element> const& lhs, std::shared_ptr<Element> const& rhs) const;
+    };
+    using Entries = std::unordered_map<std::shared_ptr<Element>, std::shared_ptr<Element>, KeyHash, KeyEqual>;
+
+    HashMap()
+        : Element(KIND)
+    {
+    }
+
+    explicit HashMap(Entries entries)
+        : Element(KIND)
+        , entries_(std::move(entries))
+    {
+    }
+
+    Entries const& getEntries() const
+    {
+        return entries_;
+    }
+
+    Entries& getEntries()
+    {
+        return entries_;
+    }
+
+private:
+    Entries entries_;
 };
 
-bool isReservedKeyword(std::string s);
+// Mutable vector with constant time indexing, equal only to itself
+class Array final : public Element
+{
+public:
+    static constexpr ElementKind KIND = ElementKind::Array;
+
+    explicit Array(std::vector<std::shared_ptr<Element>> elements)
+        : Element(KIND)
+        , elements_(std::move(elements))
+    {
+    }
+
+    std::vector<std::shared_ptr<Element>> const& getElements() const
+    {
+        return elements_;
+    }
+
+    std::vector<std::shared_ptr<Element>>& getElements()
+    {
+        return elements_;
+    }
+
+private:
+    std::vector<std::shared_ptr<Element>> elements_;
+};
+
+// Stage of a lazy sequence pipeline
+struct SequenceStage {
+    enum Kind { Map, Filter, Take } kind;
+    // Map and Filter: the function applied to each element
+    std::shared_ptr<Element> function;
+    // Take: number of elements let through
+    size_t limit = 0;
+};
+
+// Source and stages of a sequence, shared by the sequence and its tails.
+// The source is the elements of `list`, or integers by `step` up to `end`
+// (exclusive) when `bounded`
+struct SequencePipeline {
+    std::shared_ptr<List> list;
+    int64_t end  = 0;
+    int64_t step = 1;
+    bool bounded = true;
+    std::vector<SequenceStage> stages;
+};
+
+// Position in a pipeline: the next source index or integer, and the number
+// of elements that passed each Take stage
+struct SequenceCursor {
+    int64_t position = 0;
+    std::vector<size_t> taken;
+};
+
+// Lazy sequence: elements are pulled from the source through all stages
+// one at a time, only when they are needed (see sequence.hpp)
+class Sequence final : public Element
+{
+public:
+    static constexpr ElementKind KIND = ElementKind::Sequence;
+
+    Sequence(std::shared_ptr<SequencePipeline const> pipeline, SequenceCursor cursor)
+        : Element(KIND)
+        , pipeline_(std::move(pipeline))
+        , cursor_(std::move(cursor))
+    {
+    }
+
+    std::shared_ptr<SequencePipeline const> const& getPipeline() const
+    {
+        return pipeline_;
+    }
+
+    SequenceCursor const& getCursor() const
+    {
+        return cursor_;
+    }
+
+    // First element, nullptr if the sequence is empty, and the cursor after
+    // it. Pulled on the first call (defined in sequence.cpp)
+    std::shared_ptr<Element> const& first(EvalVisitor& visitor) const;
+    SequenceCursor const& rest(EvalVisitor& visitor) const;
+
+private:
+    std::shared_ptr<SequencePipeline const> pipeline_;
+    SequenceCursor cursor_;
+    // First element and the cursor after it, pulled once even if several
+    // threads ask for them
+    mutable std::once_flag pulled_;
+    mutable std::shared_ptr<Element> first_;
+    mutable SequenceCursor rest_;
+};
+
+// Value of an expression evaluated on another thread (see future.hpp)
+class Future final : public Element
+{
+public:
+    static constexpr ElementKind KIND = ElementKind::Future;
+
+    explicit Future(std::shared_ptr<FutureTask> task)
+        : Element(KIND)
+        , task_(std::move(task))
+    {
+    }
+
+    std::shared_ptr<FutureTask> const& getTask() const
+    {
+        return task_;
+    }
+
+private:
+    std::shared_ptr<FutureTask> task_;
+};
+
+bool isReservedKeyword(std::string const& s);
+
+template <class Result>
+Result ValueVisitor<Result>::visitElement(std::shared_ptr<Element> const& node)
+{
+    switch (node->kind()) {
+        case ElementKind::Identifier:
+            return visitIdentifier(std::static_pointer_cast<Identifier>(node));
+        case ElementKind::Integer:
+            return visitInteger(std::static_pointer_cast<Integer>(node));
+        case ElementKind::Real:
+            return visitReal(std::static_pointer_cast<Real>(node));
+        case ElementKind::Boolean:
+            return visitBoolean(std::static_pointer_cast<Boolean>(node));
+        case ElementKind::Null:
+            return visitNull(std::static_pointer_cast<Null>(node));
+        case ElementKind::List:
+            return visitList(std::static_pointer_cast<List>(node));
+        case ElementKind::UserFunction:
+            return visitUserFunction(std::static_pointer_cast<UserFunction>(node));
+        case ElementKind::Builtin:
+            return visitBuiltin(std::static_pointer_cast<Builtin>(node));
+        case ElementKind::HashMap:
+            return visitHashMap(std::static_pointer_cast<HashMap>(node));
+        case ElementKind::LazyBody:
+            return visitLazyBody(std::static_pointer_cast<LazyBody>(node));
+        case ElementKind::Sequence:
+            return visitSequence(std::static_pointer_cast<Sequence>(node));
+        case ElementKind::Future:
+            return visitFuture(std::static_pointer_cast<Future>(node));
+        case ElementKind::Array:
+            return visitArray(std::static_pointer_cast<Array>(node));
+    }
+    return Result();
+}
 
 } // namespace flang
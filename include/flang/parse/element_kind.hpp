@@ -0,0 +1,16 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace flang
+{
+
+// Concrete type of an Element, set once at construction
+enum class ElementKind : uint8_t { Identifier, Integer, Real, Boolean, Null, List, UserFunction, Builtin, HashMap, LazyBody, Sequence, Future, Array };
+
+const size_t N_ELEMENT_KINDS = static_cast<size_t>(ElementKind::Array) + 1;
+
+char const* kindName(ElementKind kind);
+
+} // namespace flang
@@ -0,0 +1,17 @@
+#pragma once
+
+#include <cstddef>
+
+#include "ast.hpp"
+
+namespace flang
+{
+
+// Structural equality: atoms compare by value, lists element-wise and
+// functions, hash maps and arrays by identity. An empty list is equal to null.
+bool elementsEqual(Element const& lhs, Element const& rhs);
+
+// Consistent with elementsEqual
+size_t hashElement(Element const& element);
+
+} // namespace flang
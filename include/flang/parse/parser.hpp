@@ -1,5 +1,8 @@
 #pragma once
 
+#include <memory>
+#include <string>
+#include <thread>
 #include <vector>
 
 #include "ast.hpp"
@@ -8,4 +11,18 @@
 namespace flang
 {
 Program parse(std::vector<Token> const& tokens);
+
+// Sources at least this large are split for parseSource
+const size_t PARALLEL_PARSE_MIN_SIZE = 1 << 20;
+
+// Tokenizes and parses a whole source. Large sources are cut into chunks of
+// top-level forms (see structural_index.hpp) that are handled on
+// `n_threads` threads and concatenated in order
+Program parseSource(std::string const& source, size_t n_threads = std::thread::hardware_concurrency());
+
+// Like parseSource, but the bodies of top-level `(func name (args) (...))`
+// forms are only checked for balanced parentheses. They are kept as
+// LazyBody nodes pointing into `source` and parsed on the first call, so
+// errors inside them are reported only then
+Program parseLazily(std::shared_ptr<std::string const> const& source);
 }
@@ -0,0 +1,23 @@
+#pragma once
+
+#include <cstddef>
+#include <string_view>
+#include <vector>
+
+namespace flang
+{
+
+// Start of a line where no list is open, the source can be cut there
+// without splitting a top-level form
+struct FormBoundary {
+    size_t offset;
+    size_t line;
+};
+
+// Scans the source for parentheses, quote marks and line breaks (16 bytes
+// at a time with SSE2) and returns every line start at nesting depth 0.
+// Empty if the parentheses do not balance, the source then has to be
+// handled as a whole to get the usual error
+std::vector<FormBoundary> findFormBoundaries(std::string_view source);
+
+} // namespace flang
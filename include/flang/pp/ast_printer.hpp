@@ -5,6 +5,7 @@
 #include <memory>
 #include <ostream>
 #include <sstream>
+#include <vector>
 
 namespace flang
 {
@@ -21,7 +22,6 @@ public:
     {
     }
 
-    void visitElement(std::shared_ptr<Element> node);
     void visitIdentifier(std::shared_ptr<Identifier> node) override;
     void visitInteger(std::shared_ptr<Integer> node) override;
     void visitReal(std::shared_ptr<Real> node) override;
@@ -30,9 +30,16 @@ public:
     void visitList(std::shared_ptr<List> node) override;
     void visitUserFunction(std::shared_ptr<UserFunction> node) override;
     void visitBuiltin(std::shared_ptr<Builtin> node) override;
+    void visitHashMap(std::shared_ptr<HashMap> node) override;
+    void visitLazyBody(std::shared_ptr<LazyBody> node) override;
+    void visitSequence(std::shared_ptr<Sequence> node) override;
+    void visitFuture(std::shared_ptr<Future> node) override;
+    void visitArray(std::shared_ptr<Array> node) override;
 
 private:
     std::ostream& os_;
+
+    void printNested(Element const& root);
 };
 
 std::string printElement(std::shared_ptr<Element> const& node);
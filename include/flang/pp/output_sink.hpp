@@ -0,0 +1,39 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <streambuf>
+
+namespace flang
+{
+
+const size_t DEFAULT_OUTPUT_BUFFER_SIZE = 1 << 20;
+
+// Collects program output in one large buffer and hands it to the
+// downstream buffer (stdout by default) in big chunks. The buffer is
+// allocated on first use and flushed when full, on flush() and on destruction.
+class OutputSink : public std::streambuf
+{
+public:
+    explicit OutputSink(std::streambuf* downstream, size_t capacity = DEFAULT_OUTPUT_BUFFER_SIZE);
+    ~OutputSink() override;
+
+    OutputSink(OutputSink const&)            = delete;
+    OutputSink& operator=(OutputSink const&) = delete;
+
+    void flush();
+
+protected:
+    int_type overflow(int_type ch) override;
+    std::streamsize xsputn(char const* s, std::streamsize n) override;
+    int sync() override;
+
+private:
+    std::streambuf* downstream_;
+    size_t capacity_;
+    std::unique_ptr<char[]> buffer_;
+
+    void writeBuffered();
+};
+
+} // namespace flang
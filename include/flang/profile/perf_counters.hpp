@@ -0,0 +1,110 @@
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace flang
+{
+
+enum class PerfEvent { Cycles, Instructions, CacheMisses, BranchMisses };
+const size_t N_PERF_EVENTS = static_cast<size_t>(PerfEvent::BranchMisses) + 1;
+
+struct PerfSample {
+    std::chrono::nanoseconds time {0};
+    std::array<uint64_t, N_PERF_EVENTS> events {};
+
+    PerfSample& operator+=(PerfSample const& other);
+    PerfSample operator-(PerfSample const& other) const;
+};
+
+/**
+Hardware counters (perf_event_open) of the thread that creates the object
+and of the threads it starts later, counted in user space only. Events the
+kernel refuses, e.g. in a container or VM without PMU access, read as zero
+and are left out of the report, which then shows timings only.
+PerfSpans add the counts of tokenize/parse/eval phases and, with
+`per_form`, of top-level forms.
+*/
+class PerfCounters
+{
+public:
+    explicit PerfCounters(bool per_form);
+    ~PerfCounters();
+
+    PerfCounters(PerfCounters const&)            = delete;
+    PerfCounters& operator=(PerfCounters const&) = delete;
+
+    // The counters used by PerfSpan, nullptr when counting is off
+    static PerfCounters* active()
+    {
+        return active_;
+    }
+    static bool formsActive()
+    {
+        return active_ != nullptr && active_->per_form_;
+    }
+
+    bool available(PerfEvent event) const;
+    // Spans of other threads and forms without `per_form` are not counted
+    bool counts(char const* category) const;
+    PerfSample read() const;
+
+    void record(char const* category, std::string name, PerfSample const& sample);
+
+    void write(std::ostream& os) const;
+
+private:
+    struct Entry {
+        std::string name;
+        PerfSample sample;
+    };
+
+    inline static PerfCounters* active_ = nullptr;
+
+    bool per_form_;
+    std::thread::id owner_;
+    std::array<int, N_PERF_EVENTS> fds_;
+    // Why the first unavailable event couldn't be opened
+    std::string error_;
+    std::vector<Entry> phases_;
+    std::vector<Entry> forms_;
+};
+
+class PerfSpan
+{
+public:
+    PerfSpan(char const* category, std::string name)
+        : counters_(PerfCounters::active())
+    {
+        if (counters_ != nullptr && counters_->counts(category)) {
+            category_ = category;
+            name_     = std::move(name);
+            start_    = counters_->read();
+        } else {
+            counters_ = nullptr;
+        }
+    }
+    ~PerfSpan()
+    {
+        if (counters_ != nullptr) {
+            counters_->record(category_, std::move(name_), counters_->read() - start_);
+        }
+    }
+
+    PerfSpan(PerfSpan const&)            = delete;
+    PerfSpan& operator=(PerfSpan const&) = delete;
+
+private:
+    PerfCounters* counters_;
+    char const* category_ = nullptr;
+    std::string name_;
+    PerfSample start_;
+};
+
+} // namespace flang
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <ostream>
+
+#include "shadow_stack.hpp"
+
+namespace flang
+{
+
+/**
+SIGPROF driven sampling profiler.
+The signal handler snapshots the ShadowStack of the interrupted thread into a
+lock-free ring buffer; samples are aggregated into folded stacks (the input
+format of flamegraph.pl) outside of the handler.
+*/
+class SampleProfiler
+{
+public:
+    static constexpr int MAX_HZ = 1000000;
+
+    // hz in 1..MAX_HZ. Throws std::runtime_error if the timer can't be set up
+    static void start(int hz);
+    static void stop();
+
+    // Moves pending samples from the ring buffer into the aggregate
+    static void drain();
+    // Like drain, but returns at once while another thread drains
+    static void tryDrain();
+
+    // Cheap check for the evaluators: drains only when the ring buffer fills
+    // up, on whichever of their threads gets to it first
+    static void drainIfRequested()
+    {
+        if (drain_requested_.load(std::memory_order_relaxed)) {
+            tryDrain();
+        }
+    }
+
+    static uint64_t droppedSamples();
+    static void writeFoldedStacks(std::ostream& os);
+
+private:
+    static void onSignal(int);
+    // Needs the drain mutex
+    static void drainLocked();
+
+    inline static std::atomic<bool> drain_requested_ {false};
+};
+
+} // namespace flang
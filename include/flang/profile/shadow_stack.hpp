@@ -0,0 +1,90 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <csignal>
+#include <cstdint>
+#include <string>
+
+namespace flang
+{
+
+using FrameId = uint32_t;
+
+const FrameId NO_FRAME           = 0;
+const size_t SHADOW_STACK_CAPACITY = 4096;
+
+// Maps frame names to small integer ids, so that the shadow stack and the
+// sampling signal handler never have to touch strings.
+FrameId internFrameName(std::string const& name);
+std::string const& frameName(FrameId id);
+
+/**
+Stack of the currently active UserFunction/Builtin frames.
+It is always maintained by the evaluator and only read by the sampling
+profiler from a signal handler, so pushes/pops are plain stores ordered
+with signal fences.
+*/
+class ShadowStack
+{
+public:
+    void push(FrameId frame)
+    {
+        if (depth_ < SHADOW_STACK_CAPACITY) {
+            frames_[depth_] = frame;
+        }
+        std::atomic_signal_fence(std::memory_order_release);
+        depth_ = depth_ + 1;
+    }
+
+    void pop()
+    {
+        depth_ = depth_ - 1;
+    }
+
+    size_t depth() const
+    {
+        return depth_;
+    }
+
+    FrameId const* frames() const
+    {
+        return frames_.data();
+    }
+
+    // Shadow stack of the evaluator running on the current thread
+    static ShadowStack* current();
+
+    class Activation
+    {
+    public:
+        explicit Activation(ShadowStack* stack);
+        ~Activation();
+
+    private:
+        ShadowStack* previous_;
+    };
+
+private:
+    std::array<FrameId, SHADOW_STACK_CAPACITY> frames_ {};
+    volatile sig_atomic_t depth_ = 0;
+};
+
+class ShadowFrame
+{
+public:
+    ShadowFrame(ShadowStack& stack, FrameId frame)
+        : stack_(stack)
+    {
+        stack_.push(frame);
+    }
+    ~ShadowFrame()
+    {
+        stack_.pop();
+    }
+
+private:
+    ShadowStack& stack_;
+};
+
+} // namespace flang
@@ -0,0 +1,103 @@
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <ostream>
+#include <vector>
+
+#include "flang/parse/element_kind.hpp"
+#include "shadow_stack.hpp"
+
+// Hot-path counters are only compiled in with -DENABLE_STATS=ON
+#ifdef FLANG_ENABLE_STATS
+#define FLANG_STATS(statement) statement
+#else
+#define FLANG_STATS(statement)
+#endif
+
+namespace flang
+{
+
+struct Statistics {
+    // --- Phases (always collected) ---
+    std::chrono::nanoseconds tokenize_time {0};
+    std::chrono::nanoseconds parse_time {0};
+    std::chrono::nanoseconds eval_time {0};
+
+    // --- Counters (FLANG_ENABLE_STATS only) ---
+    // Indexed by ElementKind
+    std::array<uint64_t, N_ELEMENT_KINDS> allocations {};
+    // lookup_depth[n] = number of loadVariable hits after walking n frames
+    std::vector<uint64_t> lookup_depth;
+    uint64_t lookup_misses           = 0;
+    size_t peak_environment_depth    = 0;
+    // Indexed by the FrameId of the builtin
+    std::vector<uint64_t> builtin_calls;
+    // Builtin calls that took a specialized call site / sites that fell back to the generic path
+    uint64_t quickened_calls         = 0;
+    uint64_t call_site_deopts        = 0;
+    // Forms given to eval that were found in / added to / dropped from the EvalCache
+    uint64_t eval_cache_hits         = 0;
+    uint64_t eval_cache_misses       = 0;
+    uint64_t eval_cache_evictions    = 0;
+    uint64_t returns_thrown          = 0;
+    uint64_t breaks_thrown           = 0;
+
+    void countAllocation(ElementKind kind)
+    {
+        allocations[static_cast<size_t>(kind)]++;
+    }
+
+    void countLookup(size_t frames_walked)
+    {
+        if (lookup_depth.size() <= frames_walked) {
+            lookup_depth.resize(frames_walked + 1);
+        }
+        lookup_depth[frames_walked]++;
+    }
+
+    void countBuiltinCall(FrameId builtin)
+    {
+        if (builtin_calls.size() <= builtin) {
+            builtin_calls.resize(builtin + 1);
+        }
+        builtin_calls[builtin]++;
+    }
+
+    // Adds the counts of another thread
+    void merge(Statistics const& other);
+};
+
+// Counters of the calling thread, so evaluators on several threads don't
+// share them. A thread's counters are merged into the report when it exits
+Statistics& statistics();
+// The counters of the threads that exited and of the calling thread
+Statistics collectStatistics();
+void resetStatistics();
+bool statisticsEnabled();
+
+// Peak resident set size of the process in KiB
+long peakRssKb();
+
+void printStatistics(std::ostream& os);
+
+class PhaseTimer
+{
+public:
+    explicit PhaseTimer(std::chrono::nanoseconds& accumulator)
+        : accumulator_(accumulator)
+        , start_(std::chrono::steady_clock::now())
+    {
+    }
+    ~PhaseTimer()
+    {
+        accumulator_ += std::chrono::steady_clock::now() - start_;
+    }
+
+private:
+    std::chrono::nanoseconds& accumulator_;
+    std::chrono::steady_clock::time_point start_;
+};
+
+} // namespace flang
@@ -0,0 +1,111 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "shadow_stack.hpp"
+
+namespace flang
+{
+
+/**
+In-memory recorder of Chrome trace-event spans ("ph": "X" complete events).
+Events are only buffered while the program runs; the whole trace is
+serialized once by write(), so instrumented paths never do I/O.
+*/
+class TraceRecorder
+{
+public:
+    using clock = std::chrono::steady_clock;
+
+    explicit TraceRecorder(std::chrono::microseconds call_threshold);
+    ~TraceRecorder();
+
+    // The recorder used by TraceSpan, nullptr when tracing is off
+    static TraceRecorder* active()
+    {
+        return active_;
+    }
+
+    void record(std::string category, std::string name, clock::time_point start, clock::time_point end);
+    // Function calls are named by frame id and dropped below the threshold
+    void recordCall(FrameId frame, clock::time_point start, clock::time_point end);
+
+    void write(std::ostream& os) const;
+
+private:
+    struct Event {
+        std::string category;
+        std::string name;
+        FrameId frame;
+        double ts_us;
+        double dur_us;
+        uint32_t tid;
+    };
+
+    inline static TraceRecorder* active_ = nullptr;
+
+    clock::time_point origin_;
+    clock::duration call_threshold_;
+    mutable std::mutex mutex_;
+    std::vector<Event> events_;
+
+    void push(Event event);
+    double sinceOrigin(clock::time_point point) const;
+};
+
+class TraceSpan
+{
+public:
+    TraceSpan(char const* category, std::string name)
+        : recorder_(TraceRecorder::active())
+    {
+        if (recorder_) {
+            category_ = category;
+            name_     = std::move(name);
+            start_    = TraceRecorder::clock::now();
+        }
+    }
+    ~TraceSpan()
+    {
+        if (recorder_) {
+            recorder_->record(category_, std::move(name_), start_, TraceRecorder::clock::now());
+        }
+    }
+
+private:
+    TraceRecorder* recorder_;
+    char const* category_ = nullptr;
+    std::string name_;
+    TraceRecorder::clock::time_point start_;
+};
+
+class TraceCallSpan
+{
+public:
+    explicit TraceCallSpan(FrameId frame)
+        : recorder_(TraceRecorder::active())
+        , frame_(frame)
+    {
+        if (recorder_) {
+            start_ = TraceRecorder::clock::now();
+        }
+    }
+    ~TraceCallSpan()
+    {
+        if (recorder_) {
+            recorder_->recordCall(frame_, start_, TraceRecorder::clock::now());
+        }
+    }
+
+private:
+    TraceRecorder* recorder_;
+    FrameId frame_;
+    TraceRecorder::clock::time_point start_;
+};
+
+} // namespace flang
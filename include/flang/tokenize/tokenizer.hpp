@@ -13,7 +13,9 @@ namespace flang
 class Tokenizer
 {
 public:
-    std::vector<Token> tokenize(std::string const& source) const;
+    // `first_line` is the line number of the first line of `source`,
+    // when it is a piece of a larger file
+    std::vector<Token> tokenize(std::string const& source, size_t first_line = 0) const;
 
 private:
     const std::vector<std::pair<TokenType, std::regex>> token_to_regex_ = {
@@ -0,0 +1,53 @@
+#include "flang/embed.hpp"
+#include "flang/parse/parser.hpp"
+#include "flang/tokenize/tokenizer.hpp"
+
+namespace flang
+{
+
+PreparedProgram::PreparedProgram(std::string const& source)
+{
+    if (source.size() >= PARALLEL_PARSE_MIN_SIZE) {
+        forms_ = parseSource(source);
+    } else {
+        forms_ = parse(Tokenizer().tokenize(source));
+    }
+}
+
+ExecutionContext::ExecutionContext(std::streambuf* output, size_t output_buffer_size)
+    : visitor_(output_buffer_size, output)
+{
+    // The state every run starts from: builtins only
+    visitor_.saveGlobals();
+}
+
+void ExecutionContext::bind(std::string const& name, std::shared_ptr<Element> value)
+{
+    // Checks the name, the binding itself is renewed before each run
+    visitor_.storeVariable(name, value);
+    inputs_.insert_or_assign(name, std::move(value));
+}
+
+std::shared_ptr<Element> ExecutionContext::run(PreparedProgram const& program)
+{
+    visitor_.restoreGlobals();
+    for (auto const& [name, value] : inputs_) {
+        visitor_.storeGlobal(name, value);
+    }
+    std::shared_ptr<Element> result;
+    try {
+        result = visitor_.evalProgram(program.getForms());
+    } catch (...) {
+        visitor_.output().flush();
+        throw;
+    }
+    visitor_.output().flush();
+    return result;
+}
+
+std::shared_ptr<Element> ExecutionContext::get(std::string const& name) const
+{
+    return visitor_.loadGlobal(name);
+}
+
+} // namespace flang
@@ -1,12 +1,20 @@
 #include "flang/eval/builtins.hpp"
 #include <algorithm>
+#include <flang/eval/data_reader.hpp>
 #include <flang/eval/environment_stack.hpp>
+#include <flang/eval/future.hpp>
+#include <flang/eval/runtime_heap.hpp>
+#include <flang/eval/sequence.hpp>
 #include <flang/flang_exception.hpp>
 #include <flang/parse/ast.hpp>
+#include <flang/parse/equality.hpp>
 #include <flang/pp/ast_printer.hpp>
+#include <flang/profile/stats.hpp>
 #include <functional>
 #include <iterator>
 #include <memory>
+#include <new>
+#include <optional>
 #include <stdexcept>
 #include <string>
 #include <vector>
@@ -15,52 +23,57 @@
 namespace flang
 {
 
-void print_impl(EvalVisitor* visitor, std::vector<std::shared_ptr<Element>> args)
+std::shared_ptr<Element> print_impl(EvalVisitor* visitor, Arguments args)
 {
     visitor->requireArgsNumber(args, 1);
-    std::cout << printElement(visitor->evalElement(args[0]));
+    auto val = visitor->evalElement(args[0]);
+    AstPrinter(visitor->output()).visitElement(val);
+    return val;
 }
 
-void assert_impl(EvalVisitor* visitor, std::vector<std::shared_ptr<Element>> args)
+std::shared_ptr<Element> assert_impl(EvalVisitor* visitor, Arguments args)
 {
     visitor->requireArgsNumber(args, 1);
     auto val = visitor->requireBoolean(visitor->evalElement(args[0]));
     if (!val->getValue()) {
         visitor->throwRuntimeError("Assertion error!");
     }
+    return val;
 }
 
-void setq_impl(EvalVisitor* visitor, std::vector<std::shared_ptr<Element>> args)
+std::shared_ptr<Element> setq_impl(EvalVisitor* visitor, Arguments args)
 {
     visitor->requireArgsNumber(args, 2);
     auto id  = visitor->requireIdentifier(args[0]);
     auto val = visitor->evalElement(args[1]);
     visitor->storeVariable(id->getName(), val);
+    return val;
 }
 
-void cond_impl(EvalVisitor* visitor, std::vector<std::shared_ptr<Element>> args)
+std::shared_ptr<Element> cond_impl(EvalVisitor* visitor, Arguments args)
 {
     if ((args.size() != 2) && (args.size() != 3)) {
         visitor->throwRuntimeError("cond expects 2-3 arguments");
     }
     auto cond = visitor->requireBoolean(visitor->evalElement(args[0]));
     if (cond->getValue()) {
-        visitor->evalElement(args[1]);
-    } else {
-        if (args.size() == 3) {
-            visitor->evalElement(args[2]);
-        }
+        return visitor->evalElement(args[1]);
+    }
+    if (args.size() == 3) {
+        return visitor->evalElement(args[2]);
     }
+    // Without an else branch the value is the failed condition
+    return cond;
 }
 
 
 template <bool isMacro>
-void func_impl(EvalVisitor* visitor, std::vector<std::shared_ptr<Element>> args)
+std::shared_ptr<Element> func_impl(EvalVisitor* visitor, Arguments args)
 {
     visitor->requireArgsNumber(args, 3);
-    auto id        = visitor->requireIdentifier(args[0]);
-    auto args_list = visitor->requireList(args[1])->getElements();
-    auto body      = args[2];
+    auto id               = visitor->requireIdentifier(args[0]);
+    auto const& args_list = visitor->requireList(args[1])->getElements();
+    auto const& body      = args[2];
 
     std::vector<std::string> formal_args;
     std::transform(args_list.begin(), args_list.end(), std::back_inserter(formal_args), [visitor](auto&& x) {
@@ -68,15 +81,16 @@ void func_impl(EvalVisitor* visitor, std::vector<std::shared_ptr<Element>> args)
         return id->getName();
     });
 
-    auto fn = std::make_shared<UserFunction>(id->getName(), formal_args, body, isMacro);
+    auto fn = allocateValue<UserFunction>(id->getName(), formal_args, body, isMacro);
     visitor->storeVariable(id->getName(), fn);
+    return fn;
 }
 
-void lambda_impl(EvalVisitor* visitor, std::vector<std::shared_ptr<Element>> args)
+std::shared_ptr<Element> lambda_impl(EvalVisitor* visitor, Arguments args)
 {
     visitor->requireArgsNumber(args, 2);
-    auto args_list = visitor->requireList(args[0])->getElements();
-    auto body      = args[1];
+    auto const& args_list = visitor->requireList(args[0])->getElements();
+    auto const& body      = args[1];
 
     std::vector<std::string> formal_args;
     std::transform(args_list.begin(), args_list.end(), std::back_inserter(formal_args), [visitor](auto&& x) {
@@ -84,74 +98,85 @@ void lambda_impl(EvalVisitor* visitor, std::vector<std::shared_ptr<Element>> arg
         return id->getName();
     });
 
-    auto fn = std::make_shared<UserFunction>("anonymous lambda", formal_args, body);
-    visitor->setResult(fn);
+    return allocateValue<UserFunction>("anonymous lambda", formal_args, body);
 }
 
-void return_impl(EvalVisitor* visitor, std::vector<std::shared_ptr<Element>> args)
+std::shared_ptr<Element> return_impl(EvalVisitor* visitor, Arguments args)
 {
     visitor->requireArgsNumber(args, 1);
-    visitor->setResult(visitor->evalElement(args[0]));
-    throw flang_return();
+    auto val = visitor->evalElement(args[0]);
+    FLANG_STATS(statistics().returns_thrown++);
+    throw flang_return(std::move(val));
 }
 
-void break_impl(EvalVisitor* visitor, std::vector<std::shared_ptr<Element>> args)
+std::shared_ptr<Element> break_impl(EvalVisitor* visitor, Arguments args)
 {
     visitor->requireArgsNumber(args, 0);
+    FLANG_STATS(statistics().breaks_thrown++);
     throw flang_break();
 }
 
-void while_impl(EvalVisitor* visitor, std::vector<std::shared_ptr<Element>> args)
+std::shared_ptr<Element> while_impl(EvalVisitor* visitor, Arguments args)
 {
     visitor->requireArgsNumber(args, 2);
-    auto cond = args[0];
+    auto const& cond = args[0];
     while (visitor->requireBoolean(visitor->evalElement(cond))->getValue()) {
         try {
             visitor->evalElement(args[1]);
         } catch (flang_break const& e) {
             break;
         }
+        visitor->safePoint();
     }
-    visitor->setNullResult();
+    return makeNull();
 }
 
-void quote_impl(EvalVisitor* visitor, std::vector<std::shared_ptr<Element>> args)
+std::shared_ptr<Element> quote_impl(EvalVisitor* visitor, Arguments args)
 {
     visitor->requireArgsNumber(args, 1);
-    visitor->setResult(args[0]);
+    return args[0];
 }
 
-void plus_impl(EvalVisitor* visitor, std::vector<std::shared_ptr<Element>> args)
+std::shared_ptr<Element> plus_impl(EvalVisitor* visitor, Arguments args)
 {
     visitor->requireArgsNumber(args, 2);
     auto lhs = visitor->requireInteger(visitor->evalElement(args[0]));
     auto rhs = visitor->requireInteger(visitor->evalElement(args[1]));
-    visitor->setResult(std::make_shared<Integer>(lhs->getValue() + rhs->getValue()));
+    return makeInteger(lhs->getValue() + rhs->getValue());
 }
 
-void head_impl(EvalVisitor* visitor, std::vector<std::shared_ptr<Element>> args)
+std::shared_ptr<Element> head_impl(EvalVisitor* visitor, Arguments args)
 {
     visitor->requireArgsNumber(args, 1);
-    auto list = visitor->requireList(visitor->evalElement(args[0]));
+    auto value = visitor->evalElement(args[0]);
+    if (isa<Sequence>(*value)) {
+        auto const& first = static_cast<Sequence const&>(*value).first(*visitor);
+        return first != nullptr ? first : makeNull();
+    }
+    auto list = visitor->requireList(value);
     if (list->getElements().empty()) {
-        visitor->setResult(std::make_shared<Null>());
+        return makeNull();
     } else {
-        visitor->setResult(list->getElements()[0]);
+        return list->getElements()[0];
     }
 }
 
-void tail_impl(EvalVisitor* visitor, std::vector<std::shared_ptr<Element>> args)
+std::shared_ptr<Element> tail_impl(EvalVisitor* visitor, Arguments args)
 {
     visitor->requireArgsNumber(args, 1);
-    auto list = visitor->requireList(visitor->evalElement(args[0]));
+    auto value = visitor->evalElement(args[0]);
+    if (isa<Sequence>(*value)) {
+        return sequenceRest(*visitor, static_cast<Sequence const&>(*value));
+    }
+    auto list = visitor->requireList(value);
     if (list->getElements().size() <= 1) {
-        visitor->setResult(std::make_shared<Null>());
+        return makeNull();
     } else {
-        visitor->setResult(std::make_shared<List>(std::vector<std::shared_ptr<Element>>(list->getElements().begin() + 1, list->getElements().end())));
+        return makeList(std::vector<std::shared_ptr<Element>>(list->getElements().begin() + 1, list->getElements().end()));
     }
 }
 
-void cons_impl(EvalVisitor* visitor, std::vector<std::shared_ptr<Element>> args)
+std::shared_ptr<Element> cons_impl(EvalVisitor* visitor, Arguments args)
 {
     visitor->requireArgsNumber(args, 2);
 
@@ -161,11 +186,11 @@ void cons_impl(EvalVisitor* visitor, std::vector<std::shared_ptr<Element>> args)
     std::vector<std::shared_ptr<Element>> concat_list = {head};
     std::copy(list->getElements().begin(), list->getElements().end(), std::back_inserter(concat_list));
 
-    visitor->setResult(std::make_shared<List>(std::move(concat_list)));
+    return makeList(std::move(concat_list));
 }
 
 template <class T>
-void is_type_impl(EvalVisitor* visitor, std::vector<std::shared_ptr<Element>> args)
+std::shared_ptr<Element> is_type_impl(EvalVisitor* visitor, Arguments args)
 {
     visitor->requireArgsNumber(args, 1);
 
@@ -173,165 +198,548 @@ void is_type_impl(EvalVisitor* visitor, std::vector<std::shared_ptr<Element>> ar
 
     bool result_value = false;
 
-    if (auto evaludated_arg_list = std::dynamic_pointer_cast<List>(evaluated_arg)) {
-        result_value = evaludated_arg_list->getElements().empty();
-    } else if (auto evaludated_arg_type = std::dynamic_pointer_cast<T>(evaluated_arg)) {
-        result_value = evaludated_arg_type != nullptr;
+    if (isa<List>(*evaluated_arg)) {
+        result_value = static_cast<List const&>(*evaluated_arg).getElements().empty();
+    } else if (isa<Sequence>(*evaluated_arg)) {
+        // Like the list it stands for
+        result_value = static_cast<Sequence const&>(*evaluated_arg).first(*visitor) == nullptr;
+    } else {
+        result_value = isa<T>(*evaluated_arg);
     }
 
-    visitor->setResult(std::make_shared<Boolean>(result_value));
+    return makeBoolean(result_value);
 }
 
 template <class ReturnType, class RequiredType, template <typename T = RequiredType::internal_type_t> class BinOp>
-void binop_impl(EvalVisitor* visitor, std::vector<std::shared_ptr<Element>> args)
+std::shared_ptr<Element> binop_quick(Element const& lhs, Element const& rhs)
 {
-    visitor->requireArgsNumber(args, 2);
-
-    auto lhs = visitor->evalElement(args[0]);
-    auto rhs = visitor->evalElement(args[1]);
+    auto result_value = BinOp()(static_cast<RequiredType const&>(lhs).getValue(), static_cast<RequiredType const&>(rhs).getValue());
+    if constexpr (std::is_same_v<ReturnType, Integer>) {
+        return makeInteger(result_value);
+    } else {
+        return makeBoolean(result_value);
+    }
+}
 
+template <class RequiredType>
+void require_operand(EvalVisitor* visitor, std::shared_ptr<Element> const& operand)
+{
     // TODO: Make require templated
     if constexpr (std::is_same_v<RequiredType, Integer>) {
-        lhs = visitor->requireInteger(lhs);
-        rhs = visitor->requireInteger(rhs);
+        visitor->requireInteger(operand);
     } else {
-        lhs = visitor->requireBoolean(lhs);
-        rhs = visitor->requireBoolean(rhs);
+        visitor->requireBoolean(operand);
     }
+}
 
-    auto result_value = BinOp()(std::dynamic_pointer_cast<RequiredType>(lhs)->getValue(), std::dynamic_pointer_cast<RequiredType>(rhs)->getValue());
-    visitor->setResult(std::make_shared<ReturnType>(result_value));
+template <class ReturnType, class RequiredType, template <typename T = RequiredType::internal_type_t> class BinOp>
+std::shared_ptr<Element> binop_values(EvalVisitor* visitor, std::shared_ptr<Element> const& lhs, std::shared_ptr<Element> const& rhs)
+{
+    require_operand<RequiredType>(visitor, lhs);
+    require_operand<RequiredType>(visitor, rhs);
+    return binop_quick<ReturnType, RequiredType, BinOp>(*lhs, *rhs);
 }
 
-void prog_impl(EvalVisitor* visitor, std::vector<std::shared_ptr<Element>> args)
+template <class ReturnType, class RequiredType, template <typename T = RequiredType::internal_type_t> class BinOp>
+std::shared_ptr<Element> binop_impl(EvalVisitor* visitor, Arguments args)
+{
+    visitor->requireArgsNumber(args, 2);
+
+    auto lhs = visitor->evalElement(args[0]);
+    auto rhs = visitor->evalElement(args[1]);
+    return binop_values<ReturnType, RequiredType, BinOp>(visitor, lhs, rhs);
+}
+
+template <class ReturnType, class RequiredType, template <typename T = RequiredType::internal_type_t> class BinOp>
+BinaryBuiltin binop()
+{
+    return {
+        binop_impl<ReturnType, RequiredType, BinOp>,
+        binop_values<ReturnType, RequiredType, BinOp>,
+        {{nullptr, RequiredType::KIND, RequiredType::KIND, binop_quick<ReturnType, RequiredType, BinOp>}},
+    };
+}
+
+std::shared_ptr<Element> prog_impl(EvalVisitor* visitor, Arguments args)
 {
     // 1. Check and collect args
     visitor->requireArgsNumber(args, 2);
-    auto context_list = visitor->requireList(args[0])->getElements();
-    auto body         = visitor->requireList(args[1])->getElements();
-    std::vector<std::string> context_ids;
-    std::transform(context_list.begin(), context_list.end(), std::back_inserter(context_ids), [visitor](auto&& x) {
-        auto id = visitor->requireIdentifier(x);
-        return id->getName();
-    });
+    auto const& context_list = visitor->requireList(args[0])->getElements();
+    auto const& body         = visitor->requireList(args[1])->getElements();
+    for (auto const& x : context_list) {
+        visitor->requireIdentifier(x);
+    }
     // 2. Create environment
     auto env = visitor->createScopedEnvironment();
     // 3. Add context variables
-    for (auto&& id : context_ids) {
-        visitor->storeVariable(id, std::make_shared<Null>());
+    for (auto const& x : context_list) {
+        visitor->storeVariable(static_cast<Identifier const&>(*x).getName(), makeNull());
     }
-    // 4. Eval body
-    for (auto item : body) {
-        visitor->evalElement(item);
+    // 4. Eval body, the last item gives the value
+    std::shared_ptr<Element> result = makeNull();
+    for (auto const& item : body) {
+        result = visitor->evalElement(item);
     }
+    return result;
 }
 
-void eval_impl(EvalVisitor* visitor, std::vector<std::shared_ptr<Element>> args)
+std::shared_ptr<Element> eval_impl(EvalVisitor* visitor, Arguments args)
 {
     visitor->requireArgsNumber(args, 1);
     // 1. Eval passed argument (as a regular function call)
     auto first_result = visitor->evalElement(args[0]);
-    // 2. Eval as requested
-    visitor->evalElement(first_result);
+    // 2. Eval as requested, on lists an earlier eval of the same code has warmed up
+    return visitor->evalElement(visitor->evalCache().canonical(first_result));
 }
 
-template <class EqualityOp>
-void equal_impl(EvalVisitor* visitor, std::vector<std::shared_ptr<Element>> args)
+template <bool isNegated>
+std::shared_ptr<Element> equal_values(EvalVisitor*, std::shared_ptr<Element> const& lhs, std::shared_ptr<Element> const& rhs)
+{
+    return makeBoolean(elementsEqual(*lhs, *rhs) != isNegated);
+}
+
+template <bool isNegated>
+std::shared_ptr<Element> equal_impl(EvalVisitor* visitor, Arguments args)
 {
     visitor->requireArgsNumber(args, 2);
 
     auto lhs = visitor->evalElement(args[0]);
     auto rhs = visitor->evalElement(args[1]);
 
-    bool result_value = false;
+    return equal_values<isNegated>(visitor, lhs, rhs);
+}
 
-    if (auto lhsBoolean = std::dynamic_pointer_cast<Boolean>(lhs)) {
-        if (auto rhsBoolean = std::dynamic_pointer_cast<Boolean>(rhs)) {
-            result_value = EqualityOp()(lhsBoolean->getValue(), rhsBoolean->getValue());
-        }
-    } else if (auto lhsInteger = std::dynamic_pointer_cast<Integer>(lhs)) {
-        if (auto rhsInteger = std::dynamic_pointer_cast<Integer>(rhs)) {
-            result_value = EqualityOp()(lhsInteger->getValue(), rhsInteger->getValue());
-        }
+template <bool isNegated, template <typename T> class EqualityOp>
+BinaryBuiltin equal()
+{
+    return {
+        equal_impl<isNegated>,
+        equal_values<isNegated>,
+        {
+            {nullptr, ElementKind::Integer, ElementKind::Integer, binop_quick<Boolean, Integer, EqualityOp>},
+            {nullptr, ElementKind::Boolean, ElementKind::Boolean, binop_quick<Boolean, Boolean, EqualityOp>},
+        },
+    };
+}
+
+std::shared_ptr<Element> not_impl(EvalVisitor* visitor, Arguments args)
+{
+    visitor->requireArgsNumber(args, 1);
+    auto argument = visitor->requireBoolean(visitor->evalElement(args[0]));
+    return makeBoolean(!argument->getValue());
+}
+
+// ====== Hash maps =====
+
+std::shared_ptr<Element> hashmap_impl(EvalVisitor* visitor, Arguments args)
+{
+    if (args.size() % 2 != 0) {
+        visitor->throwRuntimeError("hashmap expects key-value pairs");
+    }
+    auto map = allocateValue<HashMap>();
+    for (size_t i = 0; i < args.size(); i += 2) {
+        auto key = visitor->evalElement(args[i]);
+        map->getEntries().insert_or_assign(std::move(key), visitor->evalElement(args[i + 1]));
+    }
+    return map;
+}
+
+std::shared_ptr<Element> mapget_impl(EvalVisitor* visitor, Arguments args)
+{
+    visitor->requireArgsNumber(args, 2);
+    auto map   = visitor->requireHashMap(visitor->evalElement(args[0]));
+    auto entry = map->getEntries().find(visitor->evalElement(args[1]));
+    if (entry == map->getEntries().end()) {
+        return makeNull();
     }
+    return entry->second;
+}
 
-    visitor->setResult(std::make_shared<Boolean>(result_value));
+std::shared_ptr<Element> maphas_impl(EvalVisitor* visitor, Arguments args)
+{
+    visitor->requireArgsNumber(args, 2);
+    auto map = visitor->requireHashMap(visitor->evalElement(args[0]));
+    return makeBoolean(map->getEntries().contains(visitor->evalElement(args[1])));
+}
+
+// Persistent put: returns an updated copy and leaves the argument untouched
+std::shared_ptr<Element> mapput_impl(EvalVisitor* visitor, Arguments args)
+{
+    visitor->requireArgsNumber(args, 3);
+    auto map    = visitor->requireHashMap(visitor->evalElement(args[0]));
+    auto key    = visitor->evalElement(args[1]);
+    auto result = allocateValue<HashMap>(map->getEntries());
+    result->getEntries().insert_or_assign(std::move(key), visitor->evalElement(args[2]));
+    return result;
 }
 
-void not_impl(EvalVisitor* visitor, std::vector<std::shared_ptr<Element>> args)
+// In-place put, returns the map itself
+std::shared_ptr<Element> mapset_impl(EvalVisitor* visitor, Arguments args)
+{
+    visitor->requireArgsNumber(args, 3);
+    auto map = visitor->requireHashMap(visitor->evalElement(args[0]));
+    auto key = visitor->evalElement(args[1]);
+    map->getEntries().insert_or_assign(std::move(key), visitor->evalElement(args[2]));
+    return map;
+}
+
+// In-place delete, returns the map itself
+std::shared_ptr<Element> mapdel_impl(EvalVisitor* visitor, Arguments args)
+{
+    visitor->requireArgsNumber(args, 2);
+    auto map = visitor->requireHashMap(visitor->evalElement(args[0]));
+    map->getEntries().erase(visitor->evalElement(args[1]));
+    return map;
+}
+
+std::shared_ptr<Element> mapsize_impl(EvalVisitor* visitor, Arguments args)
 {
     visitor->requireArgsNumber(args, 1);
-    auto argument = visitor->requireBoolean(visitor->evalElement(args[0]));
-    visitor->setResult(std::make_shared<Boolean>(!argument->getValue()));
+    auto map = visitor->requireHashMap(visitor->evalElement(args[0]));
+    return makeInteger(map->getEntries().size());
 }
 
-// ====== Builtins Registry =====
+std::shared_ptr<Element> mapkeys_impl(EvalVisitor* visitor, Arguments args)
+{
+    visitor->requireArgsNumber(args, 1);
+    auto map = visitor->requireHashMap(visitor->evalElement(args[0]));
+    std::vector<std::shared_ptr<Element>> keys;
+    keys.reserve(map->getEntries().size());
+    for (auto const& [key, value] : map->getEntries()) {
+        keys.push_back(key);
+    }
+    return makeList(std::move(keys));
+}
+
+// ====== Arrays =====
+
+// (makearray n) or (makearray n init), the elements are null by default
+// Longer arrays are refused up front: the memory would be committed element
+// by element until the process is killed
+const Integer::internal_type_t MAX_ARRAY_LENGTH = Integer::internal_type_t(1) << 28;
+
+std::shared_ptr<Element> makearray_impl(EvalVisitor* visitor, Arguments args)
+{
+    if (args.empty() || args.size() > 2) {
+        visitor->throwRuntimeError("makearray expects 1-2 arguments");
+    }
+    auto length = visitor->requireInteger(visitor->evalElement(args[0]))->getValue();
+    if (length < 0) {
+        visitor->throwRuntimeError("makearray expects a non-negative length");
+    }
+    if (length > MAX_ARRAY_LENGTH) {
+        visitor->throwRuntimeError("makearray length " + std::to_string(length) + " exceeds the maximum of " + std::to_string(MAX_ARRAY_LENGTH));
+    }
+    auto init = args.size() > 1 ? visitor->evalElement(args[1]) : makeNull();
+    std::vector<std::shared_ptr<Element>> elements;
+    try {
+        elements.assign(length, init);
+    } catch (std::bad_alloc const&) {
+        visitor->throwRuntimeError("makearray could not allocate " + std::to_string(length) + " elements");
+    }
+    return allocateValue<Array>(std::move(elements));
+}
+
+size_t requireIndex(EvalVisitor* visitor, Array const& array, std::shared_ptr<Element> const& element)
+{
+    auto index = visitor->requireInteger(element)->getValue();
+    if (index < 0 || static_cast<size_t>(index) >= array.getElements().size()) {
+        visitor->throwRuntimeError("index " + std::to_string(index) + " is out of bounds for an array of length " + std::to_string(array.getElements().size()));
+    }
+    return index;
+}
+
+std::shared_ptr<Element> aref_impl(EvalVisitor* visitor, Arguments args)
+{
+    visitor->requireArgsNumber(args, 2);
+    auto array = visitor->requireArray(visitor->evalElement(args[0]));
+    return array->getElements()[requireIndex(visitor, *array, visitor->evalElement(args[1]))];
+}
+
+// In-place update, returns the array itself
+std::shared_ptr<Element> aset_impl(EvalVisitor* visitor, Arguments args)
+{
+    visitor->requireArgsNumber(args, 3);
+    auto array = visitor->requireArray(visitor->evalElement(args[0]));
+    auto index = requireIndex(visitor, *array, visitor->evalElement(args[1]));
+    array->getElements()[index] = visitor->evalElement(args[2]);
+    return array;
+}
+
+std::shared_ptr<Element> alength_impl(EvalVisitor* visitor, Arguments args)
+{
+    visitor->requireArgsNumber(args, 1);
+    auto array = visitor->requireArray(visitor->evalElement(args[0]));
+    return makeInteger(array->getElements().size());
+}
+
+// ====== Lazy sequences =====
+
+std::shared_ptr<Element> requireFunction(EvalVisitor* visitor, std::shared_ptr<Element> element)
+{
+    if (!isa<UserFunction>(*element) && !isa<Builtin>(*element)) {
+        visitor->throwRuntimeError(printElement(element) + " is not a function");
+    }
+    return element;
+}
+
+// A list or a sequence, null is the empty list
+std::shared_ptr<Element> requireSequenceSource(EvalVisitor* visitor, std::shared_ptr<Element> element)
+{
+    if (isa<Null>(*element)) {
+        return makeList({});
+    }
+    if (!isa<List>(*element) && !isa<Sequence>(*element)) {
+        visitor->throwRuntimeError(printElement(element) + " is not a list or a sequence");
+    }
+    return element;
+}
+
+std::shared_ptr<Element> range_impl(EvalVisitor* visitor, Arguments args)
+{
+    if (args.empty() || args.size() > 3) {
+        visitor->throwRuntimeError("range expects 1-3 arguments");
+    }
+    auto start = visitor->requireInteger(visitor->evalElement(args[0]))->getValue();
+    std::optional<Integer::internal_type_t> end;
+    if (args.size() > 1) {
+        end = visitor->requireInteger(visitor->evalElement(args[1]))->getValue();
+    }
+    Integer::internal_type_t step = 1;
+    if (args.size() > 2) {
+        step = visitor->requireInteger(visitor->evalElement(args[2]))->getValue();
+    }
+    if (step == 0) {
+        visitor->throwRuntimeError("range step must not be 0");
+    }
+    return makeRange(start, end, step);
+}
+
+template <SequenceStage::Kind kind>
+std::shared_ptr<Element> lazy_stage_impl(EvalVisitor* visitor, Arguments args)
+{
+    visitor->requireArgsNumber(args, 2);
+    auto function = requireFunction(visitor, visitor->evalElement(args[0]));
+    auto source   = requireSequenceSource(visitor, visitor->evalElement(args[1]));
+    return addSequenceStage(source, {kind, std::move(function)});
+}
+
+std::shared_ptr<Element> take_impl(EvalVisitor* visitor, Arguments args)
+{
+    visitor->requireArgsNumber(args, 2);
+    auto n = visitor->requireInteger(visitor->evalElement(args[0]))->getValue();
+    if (n < 0) {
+        visitor->throwRuntimeError("take expects a non-negative count");
+    }
+    auto source = requireSequenceSource(visitor, visitor->evalElement(args[1]));
+    return addSequenceStage(source, {SequenceStage::Take, nullptr, static_cast<size_t>(n)});
+}
 
-std::vector<std::shared_ptr<Builtin>> BuiltinsRegistry::getAllBuiltins()
+std::shared_ptr<Element> force_impl(EvalVisitor* visitor, Arguments args)
 {
-    std::vector<std::shared_ptr<Builtin>> result;
-    for (auto const& entry : registry_) {
-        result.emplace_back(std::make_shared<Builtin>(entry.first));
+    visitor->requireArgsNumber(args, 1);
+    auto source = requireSequenceSource(visitor, visitor->evalElement(args[0]));
+    if (isa<List>(*source)) {
+        return source;
+    }
+    std::vector<std::shared_ptr<Element>> elements;
+    forEachElement(*visitor, static_cast<Sequence const&>(*source), [&elements](auto element) { elements.push_back(std::move(element)); });
+    return makeList(std::move(elements));
+}
+
+// (reduce f init s) is (f (f init s1) s2)... without building a list
+std::shared_ptr<Element> reduce_impl(EvalVisitor* visitor, Arguments args)
+{
+    visitor->requireArgsNumber(args, 3);
+    auto function = requireFunction(visitor, visitor->evalElement(args[0]));
+    auto result   = visitor->evalElement(args[1]);
+    auto source   = requireSequenceSource(visitor, visitor->evalElement(args[2]));
+    auto combine  = [&](std::shared_ptr<Element> element) {
+        std::shared_ptr<Element> call_args[] = {std::move(result), std::move(element)};
+        result                               = visitor->callFunction(function, call_args);
+    };
+    if (isa<List>(*source)) {
+        for (auto const& element : static_cast<List const&>(*source).getElements()) {
+            combine(element);
+        }
+    } else {
+        forEachElement(*visitor, static_cast<Sequence const&>(*source), combine);
     }
     return result;
 }
 
-void BuiltinsRegistry::callBuiltin(std::shared_ptr<Builtin> builtin, std::vector<std::shared_ptr<Element>> args)
+// ====== Futures =====
+
+std::shared_ptr<Element> future_impl(EvalVisitor* visitor, Arguments args)
+{
+    visitor->requireArgsNumber(args, 1);
+    return FuturePool::instance().submit(*visitor, args[0]);
+}
+
+// Values that are not futures are their own value
+std::shared_ptr<Element> touch_impl(EvalVisitor* visitor, Arguments args)
 {
-    if (!registry_.contains(builtin->getName())) {
-        throw std::runtime_error("Builtin not found: " + builtin->getName());
+    visitor->requireArgsNumber(args, 1);
+    auto value = visitor->evalElement(args[0]);
+    if (!isa<Future>(*value)) {
+        return value;
     }
-    auto impl = registry_.at(builtin->getName());
-    impl(visitor_, args);
+    return FuturePool::instance().touch(*visitor, static_cast<Future const&>(*value));
 }
 
-void BuiltinsRegistry::registerAllBuiltins()
+// ====== Data files =====
+
+std::shared_ptr<Element> loadsexp_impl(EvalVisitor* visitor, Arguments args)
 {
-    registry_.insert_or_assign("print", print_impl);
-    registry_.insert_or_assign("assert", assert_impl);
-    registry_.insert_or_assign("setq", setq_impl);
-    registry_.insert_or_assign("cond", cond_impl);
-    registry_.insert_or_assign("func", func_impl<false>);
-    registry_.insert_or_assign("macro", func_impl<true>);
+    visitor->requireArgsNumber(args, 1);
+    auto name = visitor->requireIdentifier(visitor->evalElement(args[0]));
+    return readSExpressionFile(visitor->dataFilePath(name->getName(), "sexp"));
+}
 
-    registry_.insert_or_assign("lambda", lambda_impl);
-    registry_.insert_or_assign("prog", prog_impl);
-    registry_.insert_or_assign("eval", eval_impl);
+std::shared_ptr<Element> loadcsv_impl(EvalVisitor* visitor, Arguments args)
+{
+    visitor->requireArgsNumber(args, 1);
+    auto name = visitor->requireIdentifier(visitor->evalElement(args[0]));
+    return readCsvFile(visitor->dataFilePath(name->getName(), "csv"));
+}
 
-    registry_.insert_or_assign("return", return_impl);
-    registry_.insert_or_assign("break", break_impl);
-    registry_.insert_or_assign("while", while_impl);
-    registry_.insert_or_assign("quote", quote_impl);
+// ====== Builtins Registry =====
 
-    registry_.insert_or_assign("head", head_impl);
-    registry_.insert_or_assign("tail", tail_impl);
-    registry_.insert_or_assign("cons", cons_impl);
+BuiltinTable const& BuiltinTable::instance()
+{
+    static BuiltinTable const table;
+    return table;
+}
 
-    registry_.insert_or_assign("isint", is_type_impl<Integer>);
-    registry_.insert_or_assign("isreal", is_type_impl<Real>);
-    registry_.insert_or_assign("isbool", is_type_impl<Boolean>);
-    registry_.insert_or_assign("isnull", is_type_impl<Null>);
-    registry_.insert_or_assign("isatom", is_type_impl<Identifier>);
-    registry_.insert_or_assign("islist", is_type_impl<List>);
+BuiltinTable::BuiltinTable()
+{
+    registerAllBuiltins();
+}
 
-    registry_.insert_or_assign("plus", binop_impl<Integer, Integer, std::plus>);
-    registry_.insert_or_assign("minus", binop_impl<Integer, Integer, std::minus>);
-    registry_.insert_or_assign("times", binop_impl<Integer, Integer, std::multiplies>);
-    // TODO: Null division exception
-    registry_.insert_or_assign("divide", binop_impl<Integer, Integer, std::divides>);
+void BuiltinTable::registerBuiltin(std::string name, BuiltinImpl impl)
+{
+    builtins.emplace_back(std::make_shared<Builtin>(std::move(name), impls.size()));
+    impls.push_back(impl);
+    binaries.emplace_back();
+}
 
-    registry_.insert_or_assign("less", binop_impl<Boolean, Integer, std::less>);
-    registry_.insert_or_assign("lesseq", binop_impl<Boolean, Integer, std::less_equal>);
-    registry_.insert_or_assign("greater", binop_impl<Boolean, Integer, std::greater>);
-    registry_.insert_or_assign("greatereq", binop_impl<Boolean, Integer, std::greater_equal>);
+void BuiltinTable::registerBinaryBuiltin(std::string name, BinaryBuiltin binary)
+{
+    registerBuiltin(std::move(name), binary.impl);
+    for (auto& entry : binary.specializations) {
+        entry.builtin = builtins.back().get();
+    }
+    binaries.back() = std::make_unique<BinaryBuiltin>(std::move(binary));
+}
 
-    registry_.insert_or_assign("and", binop_impl<Boolean, Boolean, std::logical_and>);
-    registry_.insert_or_assign("or", binop_impl<Boolean, Boolean, std::logical_or>);
-    registry_.insert_or_assign("xor", binop_impl<Boolean, Boolean, std::bit_xor>);
+std::vector<std::shared_ptr<Builtin>> const& BuiltinsRegistry::getAllBuiltins() const
+{
+    return table_.builtins;
+}
+
+std::shared_ptr<Element> BuiltinsRegistry::callBuiltinAt(List const& site, Builtin const& builtin, Arguments args)
+{
+    auto const* binary = table_.binaries[builtin.getIndex()].get();
+    auto const* entry  = site.getCallSite();
+    if (binary == nullptr || args.size() != 2 || entry == &GENERIC_CALL_SITE) {
+        return callBuiltin(builtin, args);
+    }
+    FLANG_STATS(statistics().countBuiltinCall(builtin.getFrameId()));
+    auto lhs = visitor_->evalElement(args[0]);
+    auto rhs = visitor_->evalElement(args[1]);
+    if (entry != nullptr && entry->builtin == &builtin) {
+        if (lhs->kind() == entry->lhs_kind && rhs->kind() == entry->rhs_kind) {
+            FLANG_STATS(statistics().quickened_calls++);
+            return entry->impl(*lhs, *rhs);
+        }
+        FLANG_STATS(statistics().call_site_deopts++);
+        site.setCallSite(&GENERIC_CALL_SITE);
+        return binary->checked(visitor_, lhs, rhs);
+    }
+    // First call, or the name now refers to another builtin
+    auto specialization = std::find_if(binary->specializations.begin(), binary->specializations.end(), [&lhs, &rhs](auto const& candidate) {
+        return lhs->kind() == candidate.lhs_kind && rhs->kind() == candidate.rhs_kind;
+    });
+    site.setCallSite(specialization != binary->specializations.end() ? &*specialization : &GENERIC_CALL_SITE);
+    return binary->checked(visitor_, lhs, rhs);
+}
 
-    registry_.insert_or_assign("equal", equal_impl<std::equal_to<>>);
-    registry_.insert_or_assign("nonequal", equal_impl<std::not_equal_to<>>);
-    registry_.insert_or_assign("not", not_impl);
+void BuiltinTable::registerAllBuiltins()
+{
+    registerBuiltin("print", print_impl);
+    registerBuiltin("assert", assert_impl);
+    registerBuiltin("setq", setq_impl);
+    registerBuiltin("cond", cond_impl);
+    registerBuiltin("func", func_impl<false>);
+    registerBuiltin("macro", func_impl<true>);
+
+    registerBuiltin("lambda", lambda_impl);
+    registerBuiltin("prog", prog_impl);
+    registerBuiltin("eval", eval_impl);
+
+    registerBuiltin("return", return_impl);
+    registerBuiltin("break", break_impl);
+    registerBuiltin("while", while_impl);
+    registerBuiltin("quote", quote_impl);
+
+    registerBuiltin("head", head_impl);
+    registerBuiltin("tail", tail_impl);
+    registerBuiltin("cons", cons_impl);
+
+    registerBuiltin("isint", is_type_impl<Integer>);
+    registerBuiltin("isreal", is_type_impl<Real>);
+    registerBuiltin("isbool", is_type_impl<Boolean>);
+    registerBuiltin("isnull", is_type_impl<Null>);
+    registerBuiltin("isatom", is_type_impl<Identifier>);
+    registerBuiltin("islist", is_type_impl<List>);
+    registerBuiltin("ismap", is_type_impl<HashMap>);
+    registerBuiltin("isarray", is_type_impl<Array>);
+
+    registerBinaryBuiltin("plus", binop<Integer, Integer, std::plus>());
+    registerBinaryBuiltin("minus", binop<Integer, Integer, std::minus>());
+    registerBinaryBuiltin("times", binop<Integer, Integer, std::multiplies>());
+    // TODO: Null division exception
+    registerBinaryBuiltin("divide", binop<Integer, Integer, std::divides>());
+
+    registerBinaryBuiltin("less", binop<Boolean, Integer, std::less>());
+    registerBinaryBuiltin("lesseq", binop<Boolean, Integer, std::less_equal>());
+    registerBinaryBuiltin("greater", binop<Boolean, Integer, std::greater>());
+    registerBinaryBuiltin("greatereq", binop<Boolean, Integer, std::greater_equal>());
+
+    registerBinaryBuiltin("and", binop<Boolean, Boolean, std::logical_and>());
+    registerBinaryBuiltin("or", binop<Boolean, Boolean, std::logical_or>());
+    registerBinaryBuiltin("xor", binop<Boolean, Boolean, std::bit_xor>());
+
+    registerBinaryBuiltin("equal", equal<false, std::equal_to>());
+    registerBinaryBuiltin("nonequal", equal<true, std::not_equal_to>());
+    registerBuiltin("not", not_impl);
+
+    registerBuiltin("hashmap", hashmap_impl);
+    registerBuiltin("mapget", mapget_impl);
+    registerBuiltin("maphas", maphas_impl);
+    registerBuiltin("mapput", mapput_impl);
+    registerBuiltin("mapset", mapset_impl);
+    registerBuiltin("mapdel", mapdel_impl);
+    registerBuiltin("mapsize", mapsize_impl);
+    registerBuiltin("mapkeys", mapkeys_impl);
+
+    registerBuiltin("makearray", makearray_impl);
+    registerBuiltin("aref", aref_impl);
+    registerBuiltin("aset", aset_impl);
+    registerBuiltin("alength", alength_impl);
+
+    registerBuiltin("range", range_impl);
+    registerBuiltin("lazymap", lazy_stage_impl<SequenceStage::Map>);
+    registerBuiltin("lazyfilter", lazy_stage_impl<SequenceStage::Filter>);
+    registerBuiltin("take", take_impl);
+    registerBuiltin("force", force_impl);
+    registerBuiltin("reduce", reduce_impl);
+
+    registerBuiltin("future", future_impl);
+    registerBuiltin("touch", touch_impl);
+
+    registerBuiltin("loadsexp", loadsexp_impl);
+    registerBuiltin("loadcsv", loadcsv_impl);
 }
 
 } // namespace flang
@@ -0,0 +1,291 @@
+#include "flang/eval/data_reader.hpp"
+#include "flang/eval/runtime_heap.hpp"
+#include "flang/flang_exception.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <charconv>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <unordered_map>
+#include <vector>
+
+namespace flang
+{
+
+namespace
+{
+[[noreturn]] void throwDataError(std::string const& origin, size_t line, std::string const& message)
+{
+    throw flang_runtime_error(origin + ":" + std::to_string(line + 1) + ": " + message);
+}
+
+bool isDigit(char c)
+{
+    return c >= '0' && c <= '9';
+}
+
+bool isDelimiter(char c)
+{
+    return std::isspace(static_cast<unsigned char>(c)) || c == '(' || c == ')' || c == '\'';
+}
+
+bool isIdentifier(std::string_view atom)
+{
+    return std::isalpha(static_cast<unsigned char>(atom[0])) && std::all_of(atom.begin(), atom.end(), [](char c) {
+               return std::isalnum(static_cast<unsigned char>(c));
+           });
+}
+
+std::string_view trim(std::string_view field)
+{
+    auto is_blank = [](char c) { return c == ' ' || c == '\t' || c == '\r'; };
+    while (!field.empty() && is_blank(field.front())) {
+        field.remove_prefix(1);
+    }
+    while (!field.empty() && is_blank(field.back())) {
+        field.remove_suffix(1);
+    }
+    return field;
+}
+
+// Integer := [+-]?\d+ and Real := [+-]?\d+\.\d+, as in the tokenizer.
+// nullptr if the atom has another shape
+std::shared_ptr<Element> readNumber(std::string_view atom, std::string const& origin, size_t line)
+{
+    auto digits = atom;
+    if (digits[0] == '+' || digits[0] == '-') {
+        digits.remove_prefix(1);
+    }
+    if (digits.empty() || !isDigit(digits[0])) {
+        return nullptr;
+    }
+    // from_chars takes a minus sign but no plus sign
+    char const* begin = atom[0] == '+' ? digits.data() : atom.data();
+    char const* end   = atom.data() + atom.size();
+
+    Integer::internal_type_t integer = 0;
+    auto [integer_end, error]        = std::from_chars(begin, end, integer);
+    // A real has more digits before its dot than an integer can hold
+    if (error == std::errc::result_out_of_range && digits.find('.') == std::string_view::npos) {
+        throwDataError(origin, line, "Integer out of range: " + std::string(atom));
+    }
+    if (error == std::errc() && integer_end == end) {
+        return makeInteger(integer);
+    }
+
+    auto dot = digits.find('.');
+    if (dot == std::string_view::npos || dot + 1 == digits.size() || std::count(digits.begin(), digits.end(), '.') != 1 ||
+        !std::all_of(digits.begin(), digits.end(), [](char c) { return isDigit(c) || c == '.'; })) {
+        return nullptr;
+    }
+    Real::internal_type_t real = 0;
+    std::from_chars(begin, end, real);
+    return allocateValue<Real>(real);
+}
+
+class SExpressionReader
+{
+public:
+    SExpressionReader(std::string_view text, std::string const& origin)
+        : text_(text)
+        , origin_(origin)
+        , quote_(allocateValue<Identifier>("quote"))
+    {
+    }
+
+    std::shared_ptr<List> read()
+    {
+        // Open lists and pending quotes, the bottom one collects the top-level forms
+        frames_.push_back({Frame::List, 0, {}});
+        while (skipSpace()) {
+            switch (text_[position_]) {
+                case '(':
+                    frames_.push_back({Frame::List, line_, {}});
+                    ++position_;
+                    break;
+                case ')': {
+                    if (frames_.size() == 1 || frames_.back().kind != Frame::List) {
+                        throwDataError(origin_, line_, frames_.size() == 1 ? "Unexpected )" : "Quote without an element");
+                    }
+                    auto elements = std::move(frames_.back().elements);
+                    frames_.pop_back();
+                    ++position_;
+                    add(makeList(std::move(elements)));
+                    break;
+                }
+                case '\'':
+                    frames_.push_back({Frame::Quote, line_, {}});
+                    ++position_;
+                    break;
+                default:
+                    add(readAtom());
+            }
+        }
+        if (frames_.size() != 1) {
+            throwDataError(origin_, frames_.back().line, frames_.back().kind == Frame::List ? "Unterminated list" : "Quote without an element");
+        }
+        return makeList(std::move(frames_.back().elements));
+    }
+
+private:
+    struct Frame {
+        enum Kind { List, Quote } kind;
+        size_t line;
+        std::vector<std::shared_ptr<Element>> elements;
+    };
+
+    std::string_view text_;
+    std::string const& origin_;
+    size_t position_ = 0;
+    size_t line_     = 0;
+    std::vector<Frame> frames_;
+    std::shared_ptr<Identifier> quote_;
+    // Keys point into the text
+    std::unordered_map<std::string_view, std::shared_ptr<Identifier>> identifiers_;
+
+    // False at the end of the text
+    bool skipSpace()
+    {
+        for (; position_ < text_.size() && std::isspace(static_cast<unsigned char>(text_[position_])); ++position_) {
+            line_ += text_[position_] == '\n';
+        }
+        return position_ < text_.size();
+    }
+
+    void add(std::shared_ptr<Element> element)
+    {
+        while (frames_.back().kind == Frame::Quote) {
+            frames_.pop_back();
+            element = makeList({quote_, std::move(element)});
+        }
+        frames_.back().elements.push_back(std::move(element));
+    }
+
+    std::shared_ptr<Element> readAtom()
+    {
+        size_t begin = position_;
+        while (position_ < text_.size() && !isDelimiter(text_[position_])) {
+            ++position_;
+        }
+        auto atom = text_.substr(begin, position_ - begin);
+        if (atom == "true" || atom == "false") {
+            return makeBoolean(atom == "true");
+        }
+        if (atom == "null") {
+            return makeNull();
+        }
+        if (auto number = readNumber(atom, origin_, line_)) {
+            return number;
+        }
+        if (!isIdentifier(atom)) {
+            throwDataError(origin_, line_, "Unexpected atom " + std::string(atom));
+        }
+        auto& identifier = identifiers_[atom];
+        if (!identifier) {
+            identifier = allocateValue<Identifier>(std::string(atom));
+        }
+        return identifier;
+    }
+};
+
+// Read-only view of a whole file
+class MappedFile
+{
+public:
+    explicit MappedFile(std::string const& path)
+    {
+        int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            throw flang_runtime_error("Couldn't open data file " + path);
+        }
+        struct stat info {};
+        if (fstat(fd, &info) == 0 && info.st_size != 0) {
+            size_ = info.st_size;
+            data_ = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+        }
+        close(fd);
+        if (data_ == MAP_FAILED) {
+            throw flang_runtime_error("Couldn't map data file " + path);
+        }
+        if (data_ != nullptr) {
+            madvise(data_, size_, MADV_SEQUENTIAL);
+        }
+    }
+
+    ~MappedFile()
+    {
+        if (data_ != nullptr) {
+            munmap(data_, size_);
+        }
+    }
+
+    MappedFile(MappedFile const&)            = delete;
+    MappedFile& operator=(MappedFile const&) = delete;
+
+    std::string_view text() const
+    {
+        return {static_cast<char const*>(data_), size_};
+    }
+
+private:
+    void* data_  = nullptr;
+    size_t size_ = 0;
+};
+} // namespace
+
+std::shared_ptr<List> readSExpressions(std::string_view text, std::string const& origin)
+{
+    return SExpressionReader(text, origin).read();
+}
+
+std::shared_ptr<List> readCsv(std::string_view text, std::string const& origin)
+{
+    std::vector<std::shared_ptr<Element>> rows;
+    size_t row_size = 0;
+    size_t line     = 0;
+    for (size_t position = 0; position < text.size(); ++line) {
+        auto end    = std::min(text.find('\n', position), text.size());
+        auto record = text.substr(position, end - position);
+        position    = end + 1;
+        if (trim(record).empty()) {
+            continue;
+        }
+        std::vector<std::shared_ptr<Element>> fields;
+        fields.reserve(row_size);
+        while (true) {
+            auto comma = record.find(',');
+            auto field = trim(record.substr(0, comma));
+            if (field.empty()) {
+                fields.push_back(makeNull());
+            } else if (auto number = readNumber(field, origin, line)) {
+                fields.push_back(std::move(number));
+            } else {
+                throwDataError(origin, line, "Not a number: " + std::string(field));
+            }
+            if (comma == std::string_view::npos) {
+                break;
+            }
+            record.remove_prefix(comma + 1);
+        }
+        row_size = fields.size();
+        rows.push_back(makeList(std::move(fields)));
+    }
+    return makeList(std::move(rows));
+}
+
+std::shared_ptr<List> readSExpressionFile(std::string const& path)
+{
+    MappedFile file(path);
+    return readSExpressions(file.text(), path);
+}
+
+std::shared_ptr<List> readCsvFile(std::string const& path)
+{
+    MappedFile file(path);
+    return readCsv(file.text(), path);
+}
+
+} // namespace flang
@@ -1,6 +1,8 @@
 
+#include <algorithm>
 #include <flang/flang_exception.hpp>
 #include <flang/parse/ast.hpp>
+#include <flang/profile/stats.hpp>
 #include <memory>
 #include <stdexcept>
 
@@ -11,35 +13,98 @@ namespace flang
 
 void EnvironmentStack::pushEnvironment()
 {
-    if (environment_stack_.size() == MAX_STACK_SIZE) {
+    // The global environment counts as the first frame
+    if (frames_.size() + 1 == MAX_STACK_SIZE) {
         throwRuntimeError("Stack overflow!");
     }
-    Environment empty_scope;
-    environment_stack_.push_front(empty_scope);
+    frames_.push_back(bindings_.size());
+    FLANG_STATS(statistics().peak_environment_depth = std::max(statistics().peak_environment_depth, frames_.size() + 1));
 }
 
 void EnvironmentStack::popEnvironment()
 {
-    if (environment_stack_.size() == 1) {
+    if (frames_.empty()) {
         throw std::runtime_error("Cannot pop global environment");
     }
-    environment_stack_.pop_front();
+    bindings_.erase(bindings_.begin() + frames_.back(), bindings_.end());
+    frames_.pop_back();
 }
 
-std::shared_ptr<Element> EnvironmentStack::loadVariable(std::string name)
+std::shared_ptr<Element> EnvironmentStack::loadVariable(std::string const& name)
 {
-    for (auto const& env : environment_stack_) {
-        if (env.contains(name)) {
-            return env.at(name);
+    for (size_t i = bindings_.size(); i-- > 0;) {
+        if (bindings_[i].name == name) {
+            FLANG_STATS(statistics().countLookup(framesWalked(i)));
+            return bindings_[i].value;
         }
     }
+    if (auto it = globals_.find(name); it != globals_.end()) {
+        FLANG_STATS(statistics().countLookup(frames_.size() + 1));
+        return it->second;
+    }
+    FLANG_STATS(statistics().lookup_misses++);
     return nullptr;
 }
 
-void EnvironmentStack::storeVariable(std::string name, std::shared_ptr<Element> value)
+void EnvironmentStack::storeVariable(std::string const& name, std::shared_ptr<Element> value)
+{
+    if (frames_.empty()) {
+        globals_.insert_or_assign(name, std::move(value));
+        return;
+    }
+    for (size_t i = frames_.back(); i < bindings_.size(); ++i) {
+        if (bindings_[i].name == name) {
+            bindings_[i].value = std::move(value);
+            return;
+        }
+    }
+    bindings_.push_back({name, std::move(value)});
+}
+
+std::shared_ptr<Element> EnvironmentStack::loadGlobal(std::string const& name) const
+{
+    auto it = globals_.find(name);
+    return it == globals_.end() ? nullptr : it->second;
+}
+
+void EnvironmentStack::storeGlobal(std::string const& name, std::shared_ptr<Element> element)
+{
+    // A null value is looked up like a missing one
+    globals_.insert_or_assign(name, std::move(element));
+}
+
+void EnvironmentStack::saveGlobals()
 {
-    auto& env = environment_stack_.front();
-    env.insert_or_assign(name, value);
+    saved_globals_ = globals_;
+}
+
+void EnvironmentStack::restoreGlobals()
+{
+    for (auto& [name, value] : globals_) {
+        auto saved = saved_globals_.find(name);
+        value      = saved != saved_globals_.end() ? saved->second : nullptr;
+    }
+}
+
+size_t EnvironmentStack::framesWalked(size_t binding_index) const
+{
+    auto frame = std::upper_bound(frames_.begin(), frames_.end(), binding_index) - frames_.begin();
+    return frames_.size() - frame + 1;
+}
+
+std::vector<std::pair<std::string, std::shared_ptr<Element>>> EnvironmentStack::visibleBindings() const
+{
+    std::unordered_map<std::string, std::shared_ptr<Element>> visible;
+    for (auto const& [name, value] : globals_) {
+        if (value != nullptr) {
+            visible.emplace(name, value);
+        }
+    }
+    // Innermost frames last, so they shadow the outer ones
+    for (auto const& binding : bindings_) {
+        visible.insert_or_assign(binding.name, binding.value);
+    }
+    return {visible.begin(), visible.end()};
 }
 
 void EnvironmentStack::throwRuntimeError(std::string message)
@@ -0,0 +1,88 @@
+#include "flang/eval/eval_cache.hpp"
+#include "flang/parse/equality.hpp"
+#include "flang/profile/stats.hpp"
+
+#include <iterator>
+
+namespace flang
+{
+
+namespace
+{
+// Unlike elementsEqual, an empty list is not null here: (quote ()) and
+// (quote null) must not evaluate to each other's value
+bool sameCode(Element const& lhs, Element const& rhs)
+{
+    if (&lhs == &rhs) {
+        return true;
+    }
+    if (lhs.kind() != rhs.kind()) {
+        return false;
+    }
+    if (!isa<List>(lhs)) {
+        return elementsEqual(lhs, rhs);
+    }
+    auto const& lhs_elements = static_cast<List const&>(lhs).getElements();
+    auto const& rhs_elements = static_cast<List const&>(rhs).getElements();
+    if (lhs_elements.size() != rhs_elements.size()) {
+        return false;
+    }
+    for (size_t i = 0; i < lhs_elements.size(); ++i) {
+        if (!sameCode(*lhs_elements[i], *rhs_elements[i])) {
+            return false;
+        }
+    }
+    return true;
+}
+} // namespace
+
+std::shared_ptr<Element> EvalCache::canonical(std::shared_ptr<Element> const& form)
+{
+    if (capacity_ == 0 || !isa<List>(*form) || static_cast<List const&>(*form).getElements().empty()) {
+        return form;
+    }
+    auto const& list  = static_cast<List const&>(*form);
+    auto hash         = list.getHash();
+    auto [begin, end] = by_hash_.equal_range(hash);
+    for (auto it = begin; it != end; ++it) {
+        if (sameCode(**it->second, list)) {
+            hits_++;
+            FLANG_STATS(statistics().eval_cache_hits++);
+            forms_.splice(forms_.begin(), forms_, it->second);
+            return forms_.front();
+        }
+    }
+    misses_++;
+    FLANG_STATS(statistics().eval_cache_misses++);
+    forms_.push_front(std::static_pointer_cast<List>(form));
+    by_hash_.emplace(hash, forms_.begin());
+    if (forms_.size() > capacity_) {
+        evict();
+    }
+    return form;
+}
+
+void EvalCache::setCapacity(size_t capacity)
+{
+    capacity_ = capacity;
+    while (forms_.size() > capacity_) {
+        evict();
+    }
+}
+
+void EvalCache::evict()
+{
+    auto last         = std::prev(forms_.end());
+    auto [begin, end] = by_hash_.equal_range((*last)->getHash());
+    for (auto it = begin; it != end; ++it) {
+        if (it->second == last) {
+            by_hash_.erase(it);
+            break;
+        }
+    }
+    forms_.erase(last);
+    evictions_++;
+    FLANG_STATS(statistics().eval_cache_evictions++);
+}
+
+} // namespace flang
@@ -1,7 +1,12 @@
 #include <algorithm>
 #include <flang/eval/environment_stack.hpp>
+#include <flang/eval/jit.hpp>
+#include <flang/eval/runtime_heap.hpp>
 #include <flang/flang_exception.hpp>
 #include <flang/pp/ast_printer.hpp>
+#include <flang/profile/perf_counters.hpp>
+#include <flang/profile/sample_profiler.hpp>
+#include <flang/profile/trace.hpp>
 #include <iterator>
 #include <memory>
 #include <stdexcept>
@@ -14,111 +19,296 @@
 namespace flang
 {
 
-std::shared_ptr<Element> EvalVisitor::evalElement(std::shared_ptr<Element> node)
+static std::string describeForm(std::shared_ptr<Element> const& node)
 {
-    node->accept(*this);
-    return result_;
+    const size_t MAX_FORM_NAME_LENGTH = 80;
+    auto text = printElement(node);
+    if (text.size() > MAX_FORM_NAME_LENGTH) {
+        text = text.substr(0, MAX_FORM_NAME_LENGTH - 3) + "...";
+    }
+    return text;
+}
+
+EvalVisitor::EvalVisitor(ContextSnapshot const& snapshot, std::streambuf* output)
+    : EvalVisitor(0, output)
+{
+    for (auto const& [name, value] : snapshot.bindings) {
+        env_.storeVariable(name, value);
+    }
+    jit_enabled_    = snapshot.jit_enabled;
+    data_files_     = snapshot.data_files;
+    data_directory_ = snapshot.data_directory;
+}
+
+void EvalVisitor::visitProgram(Program program)
+{
+    evalProgram(program);
+}
+
+std::shared_ptr<Element> EvalVisitor::evalProgram(Program const& program)
+{
+    ShadowStack::Activation activation(&shadow_stack_);
+    std::shared_ptr<Element> result = makeNull();
+    for (auto const& node : program) {
+        TraceSpan span("form", TraceRecorder::active() ? describeForm(node) : std::string());
+        PerfSpan counters("form", PerfCounters::formsActive() ? describeForm(node) : std::string());
+        result = visitElement(node);
+    }
+    return result;
 }
 
-void EvalVisitor::visitIdentifier(std::shared_ptr<Identifier> node)
+std::shared_ptr<Element> EvalVisitor::evalElement(std::shared_ptr<Element> const& node)
 {
-    setResult(loadVariable(node->getName()));
+    return visitElement(node);
 }
 
-void EvalVisitor::visitInteger(std::shared_ptr<Integer> node)
+std::shared_ptr<Element> EvalVisitor::visitIdentifier(std::shared_ptr<Identifier> node)
 {
-    setResult(std::move(node));
+    return loadVariable(node->getName());
 }
 
-void EvalVisitor::visitReal(std::shared_ptr<Real> node)
+std::shared_ptr<Element> EvalVisitor::visitInteger(std::shared_ptr<Integer> node)
 {
-    setResult(std::move(node));
+    return node;
 }
 
-void EvalVisitor::visitBoolean(std::shared_ptr<Boolean> node)
+std::shared_ptr<Element> EvalVisitor::visitReal(std::shared_ptr<Real> node)
 {
-    setResult(std::move(node));
+    return node;
 }
 
-void EvalVisitor::visitNull(std::shared_ptr<Null> node)
+std::shared_ptr<Element> EvalVisitor::visitBoolean(std::shared_ptr<Boolean> node)
 {
-    setResult(std::move(node));
+    return node;
 }
 
-void EvalVisitor::visitList(std::shared_ptr<List> node)
+std::shared_ptr<Element> EvalVisitor::visitNull(std::shared_ptr<Null> node)
 {
-    auto elements = node->getElements();
+    return node;
+}
+
+std::shared_ptr<Element> EvalVisitor::visitList(std::shared_ptr<List> node)
+{
+    auto const& elements = node->getElements();
     // 0. Check for NIL
     if (elements.empty()) {
         // Try `(print ())` in gnu clisp 2.49.60
         // It prints NIL
-        setResult(std::make_shared<Null>());
-        return;
+        return makeNull();
     }
     // 1. Collect args
-    std::vector<std::shared_ptr<Element>> args;
-    std::copy(elements.begin() + 1, elements.end(), std::back_inserter(args));
+    auto args = Arguments(elements).subspan(1);
     // 2. Eval callee
     auto callee = evalElement(elements[0]);
-    if (auto fn = std::dynamic_pointer_cast<UserFunction>(callee)) {
-        callUserFunc(fn, args);
-    } else if (auto b = std::dynamic_pointer_cast<Builtin>(callee)) {
-        builtin_registry_->callBuiltin(b, args);
-    } else {
-        throwRuntimeError(printElement(callee) + " is not a function");
+    switch (callee->kind()) {
+        case ElementKind::UserFunction:
+            return callUserFunc(std::static_pointer_cast<UserFunction>(callee), args);
+        case ElementKind::Builtin: {
+            auto const& b = static_cast<Builtin const&>(*callee);
+            ShadowFrame frame(shadow_stack_, b.getFrameId());
+            return builtin_registry_->callBuiltinAt(*node, b, args);
+        }
+        default:
+            throwRuntimeError(printElement(callee) + " is not a function");
     }
+    return nullptr;
 }
 
-void EvalVisitor::callUserFunc(std::shared_ptr<UserFunction> fn, std::vector<std::shared_ptr<Element>> args)
+namespace
 {
-    // 1. Check arity
-    auto expected_n_args = fn->getFormalArgs().size();
-    auto actual_n_args   = args.size();
-    if (expected_n_args != actual_n_args) {
-        throwRuntimeError("Function " + fn->getName() + " expects " + std::to_string(expected_n_args) + " but got " + std::to_string(actual_n_args));
+// Truncates the evaluator-owned argument stack when a call returns or throws
+class ArgumentStackFrame
+{
+public:
+    explicit ArgumentStackFrame(std::vector<std::shared_ptr<Element>>& stack)
+        : stack_(stack)
+        , base_(stack.size())
+    {
+    }
+    ~ArgumentStackFrame()
+    {
+        stack_.resize(base_);
     }
+
+    size_t base() const
+    {
+        return base_;
+    }
+
+private:
+    std::vector<std::shared_ptr<Element>>& stack_;
+    size_t base_;
+};
+} // namespace
+
+std::shared_ptr<Element> EvalVisitor::callUserFunc(std::shared_ptr<UserFunction> const& fn, Arguments args)
+{
+    // 1. Check arity
+    checkArity(*fn, args.size());
+    safePoint();
     // 2. Eval args if needed
-    std::vector<std::shared_ptr<Element>> arg_values;
-    if (!fn->isMacro()) {
-        std::transform(args.begin(), args.end(), std::back_inserter(arg_values), [this](auto&& x) { return evalElement(x); });
-    } else {
-        std::copy(args.begin(), args.end(), std::back_inserter(arg_values));
-    }
-    // 3. Create callframe
-    ScopedEnvironment env(env_);
-    // 3. Assign arg values to arg names
-    for (int i = 0; i < expected_n_args; i++) {
-        storeVariable(fn->getFormalArgs()[i], arg_values[i]);
-    }
-    // 4. Execute function body, capturing return
+    ArgumentStackFrame arg_values(arg_stack_);
+    for (auto const& arg : args) {
+        arg_stack_.push_back(fn->isMacro() ? arg : evalElement(arg));
+    }
+    return enterUserFunc(fn, arg_values.base());
+}
+
+std::shared_ptr<Element> EvalVisitor::callFunction(std::shared_ptr<Element> const& callee, std::span<std::shared_ptr<Element> const> values)
+{
+    switch (callee->kind()) {
+        case ElementKind::UserFunction: {
+            auto const& fn = std::static_pointer_cast<UserFunction>(callee);
+            checkArity(*fn, values.size());
+            safePoint();
+            ArgumentStackFrame arg_values(arg_stack_);
+            arg_stack_.insert(arg_stack_.end(), values.begin(), values.end());
+            return enterUserFunc(fn, arg_values.base());
+        }
+        case ElementKind::Builtin: {
+            // Builtins evaluate their arguments, so values that don't evaluate to themselves are quoted
+            std::vector<std::shared_ptr<Element>> args;
+            for (auto const& value : values) {
+                bool self_evaluating = !isa<Identifier>(*value) && !(isa<List>(*value) && !static_cast<List const&>(*value).getElements().empty());
+                args.push_back(self_evaluating ? value : makeList({allocateValue<Identifier>("quote"), value}));
+            }
+            auto const& b = static_cast<Builtin const&>(*callee);
+            ShadowFrame frame(shadow_stack_, b.getFrameId());
+            return builtin_registry_->callBuiltin(b, args);
+        }
+        default:
+            throwRuntimeError(printElement(callee) + " is not a function");
+    }
+    return nullptr;
+}
+
+void EvalVisitor::checkArity(UserFunction const& fn, size_t n_args)
+{
+    auto expected_n_args = fn.getFormalArgs().size();
+    if (expected_n_args != n_args) {
+        throwRuntimeError("Function " + fn.getName() + " expects " + std::to_string(expected_n_args) + " but got " + std::to_string(n_args));
+    }
+}
+
+std::shared_ptr<Element> EvalVisitor::enterUserFunc(std::shared_ptr<UserFunction> const& fn, size_t args_base)
+{
+    // 3. Run natively if the JIT takes the call
+    if (jit_enabled_ && !fn->isMacro()) {
+        if (auto result = jitCall(env_, fn, Arguments(arg_stack_).subspan(args_base))) {
+            return result;
+        }
+    }
+    // 4. Create callframe
+    SampleProfiler::drainIfRequested();
+    ScopedEnvironment env(env_, shadow_stack_, fn->getFrameId());
+    TraceCallSpan span(fn->getFrameId());
+    // 5. Assign arg values to arg names
+    for (size_t i = 0; i < fn->getFormalArgs().size(); i++) {
+        storeVariable(fn->getFormalArgs()[i], std::move(arg_stack_[args_base + i]));
+    }
+    // 6. Execute function body, capturing return
     try {
-        evalElement(fn->getBody());
-    } catch (flang_return const& e) {
-        // Return calls setResult,
-        // so we dont have to do anything here
+        return evalElement(fn->getBody());
+    } catch (flang_return& e) {
+        return std::move(e.value());
     } catch (flang_break const& e) {
         throwRuntimeError("Out-of-loop 'break' in function " + fn->getName());
     }
+    return nullptr;
+}
+
+std::shared_ptr<Element> EvalVisitor::visitUserFunction(std::shared_ptr<UserFunction> node)
+{
+    return node;
+}
+
+std::shared_ptr<Element> EvalVisitor::visitBuiltin(std::shared_ptr<Builtin> node)
+{
+    return node;
+}
+
+std::shared_ptr<Element> EvalVisitor::visitHashMap(std::shared_ptr<HashMap> node)
+{
+    return node;
 }
 
-void EvalVisitor::visitUserFunction(std::shared_ptr<UserFunction> node)
+std::shared_ptr<Element> EvalVisitor::visitLazyBody(std::shared_ptr<LazyBody> node)
 {
-    setResult(std::move(node));
+    return evalElement(node->force());
 }
 
-void EvalVisitor::visitBuiltin(std::shared_ptr<Builtin> node)
+std::shared_ptr<Element> EvalVisitor::visitSequence(std::shared_ptr<Sequence> node)
 {
-    setResult(std::move(node));
+    return node;
 }
 
-void EvalVisitor::setResult(std::shared_ptr<Element> element)
+std::shared_ptr<Element> EvalVisitor::visitFuture(std::shared_ptr<Future> node)
 {
-    result_ = std::move(element);
+    return node;
 }
 
-void EvalVisitor::setNullResult()
+std::shared_ptr<Element> EvalVisitor::visitArray(std::shared_ptr<Array> node)
 {
-    setResult(std::make_shared<Null>());
+    return node;
+}
+
+std::ostream& EvalVisitor::output()
+{
+    return output_;
+}
+
+void EvalVisitor::enableJit()
+{
+    jit_enabled_ = jitSupported();
+}
+
+void EvalVisitor::addDataFile(std::string const& name, std::string path)
+{
+    data_files_[name] = std::move(path);
+}
+
+void EvalVisitor::setDataDirectory(std::string directory)
+{
+    data_directory_ = std::move(directory);
+}
+
+std::string EvalVisitor::dataFilePath(std::string const& name, std::string const& extension) const
+{
+    auto file = data_files_.find(name);
+    if (file != data_files_.end()) {
+        return file->second;
+    }
+    return data_directory_ + "/" + name + "." + extension;
+}
+
+void EvalVisitor::setYieldHook(size_t fuel, std::function<void()> yield)
+{
+    fuel_      = std::max<size_t>(fuel, 1);
+    fuel_left_ = fuel_;
+    yield_     = std::move(yield);
+}
+
+void EvalVisitor::refuel()
+{
+    if (!yield_) {
+        fuel_left_ = std::numeric_limits<size_t>::max();
+        return;
+    }
+    fuel_left_ = fuel_;
+    yield_();
+}
+
+ContextSnapshot EvalVisitor::snapshotContext() const
+{
+    ContextSnapshot snapshot {{}, jit_enabled_, data_files_, data_directory_};
+    for (auto& binding : env_.visibleBindings()) {
+        // Every interpreter starts with the builtins
+        bool builtin = isa<Builtin>(*binding.second) && static_cast<Builtin const&>(*binding.second).getName() == binding.first;
+        if (!builtin) {
+            snapshot.bindings.push_back(std::move(binding));
+        }
+    }
+    return snapshot;
 }
 
 ScopedEnvironment EvalVisitor::createScopedEnvironment()
@@ -143,14 +333,34 @@ void EvalVisitor::storeVariable(std::string const& name, std::shared_ptr<Element
     return env_.storeVariable(name, std::move(element));
 }
 
+std::shared_ptr<Element> EvalVisitor::loadGlobal(std::string const& name) const
+{
+    return env_.loadGlobal(name);
+}
+
+void EvalVisitor::storeGlobal(std::string const& name, std::shared_ptr<Element> element)
+{
+    env_.storeGlobal(name, std::move(element));
+}
+
+void EvalVisitor::saveGlobals()
+{
+    env_.saveGlobals();
+}
+
+void EvalVisitor::restoreGlobals()
+{
+    env_.restoreGlobals();
+}
+
 void EvalVisitor::throwRuntimeError(std::string const& message)
 {
     return env_.throwRuntimeError(message);
 }
 
-std::shared_ptr<Integer> EvalVisitor::requireInteger(std::shared_ptr<Element> element)
+std::shared_ptr<Integer> EvalVisitor::requireInteger(std::shared_ptr<Element> const& element)
 {
-    auto result = std::dynamic_pointer_cast<Integer>(element);
+    auto result = elementCast<Integer>(element);
     if (!result) {
         // TODO: print element
         throwRuntimeError(printElement(element) + " is not an integer");
@@ -158,9 +368,9 @@ std::shared_ptr<Integer> EvalVisitor::requireInteger(std::shared_ptr<Element> el
     return result;
 }
 
-std::shared_ptr<Real> EvalVisitor::requireReal(std::shared_ptr<Real> element)
+std::shared_ptr<Real> EvalVisitor::requireReal(std::shared_ptr<Element> const& element)
 {
-    auto result = std::dynamic_pointer_cast<Real>(element);
+    auto result = elementCast<Real>(element);
     if (!result) {
         // TODO: print element
         throwRuntimeError(printElement(element) + " is not a real number");
@@ -168,9 +378,9 @@ std::shared_ptr<Real> EvalVisitor::requireReal(std::shared_ptr<Real> element)
     return result;
 }
 
-std::shared_ptr<Boolean> EvalVisitor::requireBoolean(std::shared_ptr<Element> element)
+std::shared_ptr<Boolean> EvalVisitor::requireBoolean(std::shared_ptr<Element> const& element)
 {
-    auto result = std::dynamic_pointer_cast<Boolean>(element);
+    auto result = elementCast<Boolean>(element);
     if (!result) {
         // TODO: print element
         throwRuntimeError(printElement(element) + " is not a boolean");
@@ -178,9 +388,9 @@ std::shared_ptr<Boolean> EvalVisitor::requireBoolean(std::shared_ptr<Element> el
     return result;
 }
 
-std::shared_ptr<List> EvalVisitor::requireList(std::shared_ptr<Element> element)
+std::shared_ptr<List> EvalVisitor::requireList(std::shared_ptr<Element> const& element)
 {
-    auto result = std::dynamic_pointer_cast<List>(element);
+    auto result = elementCast<List>(element);
     if (!result) {
         // TODO: print element
         throwRuntimeError(printElement(element) + " is not a list");
@@ -188,9 +398,9 @@ std::shared_ptr<List> EvalVisitor::requireList(std::shared_ptr<Element> element)
     return result;
 }
 
-std::shared_ptr<Identifier> EvalVisitor::requireIdentifier(std::shared_ptr<Element> element)
+std::shared_ptr<Identifier> EvalVisitor::requireIdentifier(std::shared_ptr<Element> const& element)
 {
-    auto result = std::dynamic_pointer_cast<Identifier>(element);
+    auto result = elementCast<Identifier>(element);
     if (!result) {
         // TODO: print element
         throwRuntimeError(printElement(element) + " is not an identifier");
@@ -198,7 +408,25 @@ std::shared_ptr<Identifier> EvalVisitor::requireIdentifier(std::shared_ptr<Eleme
     return result;
 }
 
-void EvalVisitor::requireArgsNumber(std::vector<std::shared_ptr<Element>> args, int n)
+std::shared_ptr<HashMap> EvalVisitor::requireHashMap(std::shared_ptr<Element> const& element)
+{
+    auto result = elementCast<HashMap>(element);
+    if (!result) {
+        throwRuntimeError(printElement(element) + " is not a hash map");
+    }
+    return result;
+}
+
+std::shared_ptr<Array> EvalVisitor::requireArray(std::shared_ptr<Element> const& element)
+{
+    auto result = elementCast<Array>(element);
+    if (!result) {
+        throwRuntimeError(printElement(element) + " is not an array");
+    }
+    return result;
+}
+
+void EvalVisitor::requireArgsNumber(Arguments args, size_t n)
 {
     auto actual_n = args.size();
     if (actual_n != n) {
@@ -208,7 +436,7 @@ void EvalVisitor::requireArgsNumber(std::vector<std::shared_ptr<Element>> args,
 
 void EvalVisitor::setAllBuiltins()
 {
-    for (auto builtin : builtin_registry_->getAllBuiltins()) {
+    for (auto const& builtin : builtin_registry_->getAllBuiltins()) {
         env_.storeVariable(builtin->getName(), builtin);
     }
 }
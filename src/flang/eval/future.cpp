@@ -0,0 +1,230 @@
+#include "flang/eval/future.hpp"
+#include "flang/eval/runtime_heap.hpp"
+
+#include <algorithm>
+#include <limits>
+#include <sstream>
+
+namespace flang
+{
+
+namespace
+{
+const size_t NOT_A_WORKER = std::numeric_limits<size_t>::max();
+
+// Index of the worker running on this thread
+thread_local size_t current_worker = NOT_A_WORKER;
+} // namespace
+
+FuturePool& FuturePool::instance()
+{
+    static FuturePool pool;
+    return pool;
+}
+
+FuturePool::FuturePool()
+    : n_threads_(std::max(std::thread::hardware_concurrency(), 1u))
+{
+}
+
+FuturePool::~FuturePool()
+{
+    stop();
+}
+
+void FuturePool::setThreads(size_t n)
+{
+    stop();
+    n_threads_ = std::max<size_t>(n, 1);
+}
+
+void FuturePool::shutdown()
+{
+    std::lock_guard lock(start_mutex_);
+    stop();
+}
+
+void FuturePool::start()
+{
+    stopping_ = false;
+    for (size_t i = 0; i < n_threads_; ++i) {
+        deques_.push_back(std::make_unique<Worker>());
+    }
+    for (size_t i = 0; i + 1 < n_threads_; ++i) {
+        threads_.emplace_back(&FuturePool::workerLoop, this, i);
+    }
+    // Until the workers wait for tasks every future would be evaluated inline
+    while (idle_.load() < threads_.size()) {
+        std::this_thread::yield();
+    }
+}
+
+void FuturePool::stop()
+{
+    {
+        std::lock_guard lock(sleep_mutex_);
+        stopping_ = true;
+    }
+    work_cv_.notify_all();
+    for (auto& thread : threads_) {
+        thread.join();
+    }
+    threads_.clear();
+    deques_.clear();
+    started_ = false;
+}
+
+void FuturePool::workerLoop(size_t index)
+{
+    current_worker = index;
+    while (!stopping_) {
+        if (auto task = findTask()) {
+            run(*task);
+            continue;
+        }
+        std::unique_lock lock(sleep_mutex_);
+        idle_++;
+        work_cv_.wait(lock, [this] { return stopping_ || queued_.load() > 0; });
+        idle_--;
+    }
+}
+
+std::shared_ptr<Future> FuturePool::submit(EvalVisitor& visitor, std::shared_ptr<Element> expression)
+{
+    if (!started_.load(std::memory_order_acquire)) {
+        std::lock_guard lock(start_mutex_);
+        if (!started_.load(std::memory_order_relaxed)) {
+            start();
+            started_.store(true, std::memory_order_release);
+        }
+    }
+    auto task        = std::make_shared<FutureTask>();
+    task->expression = std::move(expression);
+    if (idle_.load() <= queued_.load()) {
+        runInline(visitor, *task);
+        return allocateValue<Future>(std::move(task));
+    }
+    task->snapshot = visitor.snapshotContext();
+    auto& deque    = *deques_[current_worker != NOT_A_WORKER ? current_worker : deques_.size() - 1];
+    // Counted first, so a worker that takes the task right away doesn't see fewer than zero queued
+    queued_++;
+    {
+        std::lock_guard lock(deque.mutex);
+        deque.tasks.push_back(task);
+    }
+    {
+        std::lock_guard lock(sleep_mutex_);
+    }
+    work_cv_.notify_one();
+    return allocateValue<Future>(std::move(task));
+}
+
+std::shared_ptr<Element> FuturePool::touch(EvalVisitor& visitor, Future const& future)
+{
+    auto& task = *future.getTask();
+    if (claim(task)) {
+        run(task);
+    }
+    while (task.state.load() != FutureTask::Done) {
+        if (auto other = findTask()) {
+            run(*other);
+            continue;
+        }
+        std::unique_lock lock(task.mutex);
+        task.done_cv.wait(lock, [&task] { return task.state.load() == FutureTask::Done; });
+    }
+
+    std::lock_guard lock(task.mutex);
+    if (!task.output_printed) {
+        visitor.output() << task.output;
+        task.output.clear();
+        task.output_printed = true;
+    }
+    if (task.error) {
+        std::rethrow_exception(task.error);
+    }
+    return task.value;
+}
+
+std::shared_ptr<FutureTask> FuturePool::findTask()
+{
+    if (deques_.empty()) {
+        return nullptr;
+    }
+    size_t self = current_worker != NOT_A_WORKER ? current_worker : deques_.size() - 1;
+    // Own tasks newest first, they are the likeliest to be touched next
+    {
+        auto& own = *deques_[self];
+        std::lock_guard lock(own.mutex);
+        while (!own.tasks.empty()) {
+            auto task = std::move(own.tasks.back());
+            own.tasks.pop_back();
+            if (claim(*task)) {
+                return task;
+            }
+        }
+    }
+    // Others' oldest first, they are the likeliest to be large
+    for (size_t i = 1; i < deques_.size(); ++i) {
+        auto& victim = *deques_[(self + i) % deques_.size()];
+        std::lock_guard lock(victim.mutex);
+        while (!victim.tasks.empty()) {
+            auto task = std::move(victim.tasks.front());
+            victim.tasks.pop_front();
+            if (claim(*task)) {
+                return task;
+            }
+        }
+    }
+    return nullptr;
+}
+
+// Tasks touched before a worker took them are still in a deque, Running or Done
+bool FuturePool::claim(FutureTask& task)
+{
+    auto expected = FutureTask::Queued;
+    if (!task.state.compare_exchange_strong(expected, FutureTask::Running)) {
+        return false;
+    }
+    queued_--;
+    return true;
+}
+
+void FuturePool::run(FutureTask& task)
+{
+    std::stringbuf output;
+    try {
+        EvalVisitor child(task.snapshot, &output);
+        // Without it the profiler drops the samples taken on this thread
+        ShadowStack::Activation activation(&child.shadowStack());
+        task.value = child.evalElement(task.expression);
+    } catch (...) {
+        task.error = std::current_exception();
+    }
+    task.snapshot = {};
+    {
+        std::lock_guard lock(task.mutex);
+        task.output = output.str();
+        task.state  = FutureTask::Done;
+    }
+    task.done_cv.notify_all();
+}
+
+void FuturePool::runInline(EvalVisitor& visitor, FutureTask& task)
+{
+    // A frame of its own keeps the setq of the expression from the caller,
+    // as in another interpreter
+    std::stringbuf output;
+    auto* caller_output = visitor.output().rdbuf(&output);
+    try {
+        auto scope = visitor.createScopedEnvironment();
+        task.value = visitor.evalElement(task.expression);
+    } catch (...) {
+        task.error = std::current_exception();
+    }
+    visitor.output().rdbuf(caller_output);
+    task.output = output.str();
+    task.state  = FutureTask::Done;
+}
+
+} // namespace flang
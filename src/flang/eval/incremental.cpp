@@ -0,0 +1,333 @@
+#include "flang/eval/incremental.hpp"
+#include "flang/eval/eval_visitor.hpp"
+#include "flang/parse/equality.hpp"
+
+#include <algorithm>
+#include <deque>
+#include <limits>
+#include <string_view>
+#include <unordered_set>
+#include <utility>
+
+namespace flang
+{
+
+namespace
+{
+const size_t NO_MATCH = std::numeric_limits<size_t>::max();
+
+using NameSet = std::unordered_set<std::string>;
+// Name -> functions whose bodies read it
+using Readers = std::unordered_map<std::string, std::vector<std::string>>;
+
+// Builtins that change their first argument in place
+bool isMutatingBuiltin(std::string_view name)
+{
+    return name == "mapset" || name == "mapdel" || name == "aset";
+}
+
+// Function or macro defined by a top-level form
+struct Definition {
+    std::string name;
+    bool is_macro = false;
+    std::vector<std::string> formal_args;
+    // Globals the body reads
+    std::vector<std::string> reads;
+};
+
+struct FormNames {
+    std::vector<std::string> reads;
+    std::vector<std::string> writes;
+    // Written names whose value is changed in place, a subset of writes
+    std::vector<std::string> mutations;
+    // A deque keeps the read lists in place while they are being filled
+    std::deque<Definition> definitions;
+};
+
+Identifier const* asIdentifier(Element const& element)
+{
+    return isa<Identifier>(element) ? &static_cast<Identifier const&>(element) : nullptr;
+}
+
+void sortUnique(std::vector<std::string>& names)
+{
+    std::sort(names.begin(), names.end());
+    names.erase(std::unique(names.begin(), names.end()), names.end());
+}
+
+// Globals a top-level form reads and writes. A setq in a function body or a
+// prog block writes to the local frame, so only reads are collected there
+FormNames collectNames(Element const& form)
+{
+    struct Pending {
+        Element const* element;
+        std::vector<std::string>* reads;
+        bool local;
+    };
+    FormNames names;
+    std::vector<Pending> pending {{&form, &names.reads, false}};
+    while (!pending.empty()) {
+        auto [element, reads, local] = pending.back();
+        pending.pop_back();
+        if (auto const* identifier = asIdentifier(*element)) {
+            reads->push_back(identifier->getName());
+            continue;
+        }
+        if (!isa<List>(*element) || static_cast<List const&>(*element).getElements().empty()) {
+            continue;
+        }
+        auto const& elements = static_cast<List const&>(*element).getElements();
+        auto const* head     = asIdentifier(*elements[0]);
+        auto keyword         = head != nullptr ? std::string_view(head->getName()) : std::string_view();
+        auto const* target   = elements.size() > 1 ? asIdentifier(*elements[1]) : nullptr;
+        if (keyword == "quote") {
+            continue;
+        }
+        if ((keyword == "func" || keyword == "macro") && elements.size() == 4 && target != nullptr && !local) {
+            names.writes.push_back(target->getName());
+            auto& definition    = names.definitions.emplace_back();
+            definition.name     = target->getName();
+            definition.is_macro = keyword == "macro";
+            if (isa<List>(*elements[2])) {
+                for (auto const& arg : static_cast<List const&>(*elements[2]).getElements()) {
+                    if (auto const* arg_identifier = asIdentifier(*arg)) {
+                        definition.formal_args.push_back(arg_identifier->getName());
+                    }
+                }
+            }
+            pending.push_back({elements[3].get(), &definition.reads, true});
+            continue;
+        }
+        if (keyword == "setq" && target != nullptr) {
+            if (!local) {
+                names.writes.push_back(target->getName());
+            }
+            for (size_t i = 2; i < elements.size(); ++i) {
+                pending.push_back({elements[i].get(), reads, local});
+            }
+            continue;
+        }
+        if (isMutatingBuiltin(keyword) && target != nullptr && !local) {
+            names.writes.push_back(target->getName());
+            names.mutations.push_back(target->getName());
+        }
+        bool enters_frame = keyword == "prog" || keyword == "lambda" || keyword == "func" || keyword == "macro";
+        for (auto const& child : elements) {
+            pending.push_back({child.get(), reads, local || enters_frame});
+        }
+    }
+    sortUnique(names.reads);
+    sortUnique(names.writes);
+    sortUnique(names.mutations);
+    for (auto& definition : names.definitions) {
+        sortUnique(definition.reads);
+        std::erase_if(definition.reads, [&definition](std::string const& name) {
+            return std::find(definition.formal_args.begin(), definition.formal_args.end(), name) != definition.formal_args.end();
+        });
+    }
+    return names;
+}
+
+// Adds `name` and every function that reads it, directly or through other functions
+void insertWithReaders(NameSet& names, std::string const& name, Readers const& readers)
+{
+    if (!names.insert(name).second) {
+        return;
+    }
+    std::vector<std::string const*> pending {&name};
+    while (!pending.empty()) {
+        auto it = readers.find(*pending.back());
+        pending.pop_back();
+        if (it == readers.end()) {
+            continue;
+        }
+        for (auto const& reader : it->second) {
+            if (names.insert(reader).second) {
+                pending.push_back(&reader);
+            }
+        }
+    }
+}
+
+bool readsAny(FormNames const& names, NameSet const& set)
+{
+    return !set.empty() && std::any_of(names.reads.begin(), names.reads.end(), [&set](auto const& name) { return set.contains(name); });
+}
+} // namespace
+
+struct IncrementalProgram::Form {
+    std::shared_ptr<Element> node;
+    size_t hash = 0;
+    FormNames names;
+    // Calls eval or a macro
+    bool opaque    = false;
+    bool evaluated = false;
+    // Values of names.writes right after the form was evaluated
+    std::vector<std::shared_ptr<Element>> written_values;
+};
+
+IncrementalProgram::IncrementalProgram(EvalVisitor& visitor)
+    : visitor_(visitor)
+{
+}
+
+IncrementalProgram::~IncrementalProgram() = default;
+
+UpdateReport IncrementalProgram::update(Program program)
+{
+    // 1. Summarize the new forms
+    std::vector<Form> forms(program.size());
+    Readers readers;
+    NameSet opaque_roots {"eval"};
+    for (size_t i = 0; i < program.size(); ++i) {
+        auto& form = forms[i];
+        form.node  = std::move(program[i]);
+        form.hash  = hashElement(*form.node);
+        form.names = collectNames(*form.node);
+        for (auto const& definition : form.names.definitions) {
+            for (auto const& read : definition.reads) {
+                readers[read].push_back(definition.name);
+            }
+            if (definition.is_macro) {
+                opaque_roots.insert(definition.name);
+            }
+        }
+        for (auto const& write : form.names.writes) {
+            if (!initial_globals_.contains(write)) {
+                initial_globals_.emplace(write, visitor_.loadGlobal(write));
+            }
+        }
+    }
+    NameSet opaque;
+    for (auto const& root : opaque_roots) {
+        insertWithReaders(opaque, root, readers);
+    }
+    for (auto& form : forms) {
+        form.opaque = readsAny(form.names, opaque);
+    }
+
+    // 2. Match them with the old forms, keeping the order
+    std::unordered_map<size_t, std::deque<size_t>> old_by_hash;
+    for (size_t j = 0; j < forms_.size(); ++j) {
+        old_by_hash[forms_[j].hash].push_back(j);
+    }
+    std::vector<size_t> match(forms.size(), NO_MATCH);
+    std::vector<bool> old_matched(forms_.size());
+    size_t next_old = 0;
+    for (size_t i = 0; i < forms.size(); ++i) {
+        auto it = old_by_hash.find(forms[i].hash);
+        if (it == old_by_hash.end()) {
+            continue;
+        }
+        auto& candidates = it->second;
+        while (!candidates.empty() && candidates.front() < next_old) {
+            candidates.pop_front();
+        }
+        if (!candidates.empty() && elementsEqual(*forms_[candidates.front()].node, *forms[i].node)) {
+            match[i]              = candidates.front();
+            old_matched[match[i]] = true;
+            next_old              = match[i] + 1;
+            candidates.pop_front();
+        }
+    }
+
+    NameSet changed;
+    // Globals whose binding differs from the program state at the current form
+    NameSet stale;
+    // Names changed in place by a form that is evaluated again or removed
+    NameSet rebuilt;
+    for (size_t j = 0; j < forms_.size(); ++j) {
+        for (auto const& write : forms_[j].names.writes) {
+            if (!old_matched[j]) {
+                insertWithReaders(changed, write, readers);
+            }
+            stale.insert(write);
+        }
+        if (!old_matched[j]) {
+            rebuilt.insert(forms_[j].names.mutations.begin(), forms_[j].names.mutations.end());
+        }
+    }
+
+    // 3. A value changed in place must not be changed again, so every form
+    //    writing such a name is evaluated again, from the one that created the
+    //    value on. Which forms change values in place is planned as if every
+    //    evaluated form changed the names it writes
+    auto writesRebuilt = [&rebuilt](Form const& form) {
+        return std::any_of(form.names.writes.begin(), form.names.writes.end(), [&rebuilt](auto const& name) { return rebuilt.contains(name); });
+    };
+    for (bool grew = true; grew;) {
+        grew              = false;
+        NameSet planned   = changed;
+        bool planned_rest = false;
+        for (size_t i = 0; i < forms.size(); ++i) {
+            auto& form = forms[i];
+            auto* old  = match[i] != NO_MATCH ? &forms_[match[i]] : nullptr;
+            if (!planned_rest && old != nullptr && old->evaluated && !readsAny(form.names, planned) && !(form.opaque && !planned.empty()) &&
+                !writesRebuilt(form)) {
+                continue;
+            }
+            for (auto const& write : form.names.writes) {
+                insertWithReaders(planned, write, readers);
+            }
+            for (auto const& mutation : form.names.mutations) {
+                grew = rebuilt.insert(mutation).second || grew;
+            }
+            planned_rest = planned_rest || form.opaque;
+        }
+    }
+
+    // 4. Evaluate the changed forms and the ones reading changed names
+    std::unordered_map<std::string, std::shared_ptr<Element>> current;
+    auto sync = [&] {
+        for (auto const& name : stale) {
+            auto it = current.find(name);
+            visitor_.storeGlobal(name, it != current.end() ? it->second : initial_globals_.at(name));
+        }
+        stale.clear();
+    };
+
+    UpdateReport report {forms.size(), 0};
+    bool evaluate_rest = false;
+    for (size_t i = 0; i < forms.size(); ++i) {
+        auto& form = forms[i];
+        auto* old  = match[i] != NO_MATCH ? &forms_[match[i]] : nullptr;
+        if (!evaluate_rest && old != nullptr && old->evaluated && !readsAny(form.names, changed) && !(form.opaque && !changed.empty()) &&
+            !writesRebuilt(form)) {
+            form.evaluated      = true;
+            form.written_values = std::move(old->written_values);
+            for (size_t k = 0; k < form.names.writes.size(); ++k) {
+                current[form.names.writes[k]] = form.written_values[k];
+                stale.insert(form.names.writes[k]);
+            }
+            continue;
+        }
+        sync();
+        try {
+            visitor_.visitProgram({form.node});
+        } catch (...) {
+            sync();
+            forms_ = std::move(forms);
+            throw;
+        }
+        form.evaluated = true;
+        report.evaluated++;
+        for (size_t k = 0; k < form.names.writes.size(); ++k) {
+            auto const& name = form.names.writes[k];
+            auto value       = visitor_.loadGlobal(name);
+            // Dependents of a form that computed the same value again are up to date
+            bool same = !rebuilt.contains(name) && old != nullptr && k < old->written_values.size() && value != nullptr && old->written_values[k] != nullptr &&
+                        elementsEqual(*value, *old->written_values[k]);
+            if (!same) {
+                insertWithReaders(changed, name, readers);
+            }
+            current[name] = value;
+            form.written_values.push_back(std::move(value));
+        }
+        evaluate_rest = evaluate_rest || form.opaque;
+    }
+    sync();
+    forms_ = std::move(forms);
+    return report;
+}
+
+} // namespace flang
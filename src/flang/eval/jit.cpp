@@ -0,0 +1,594 @@
+#include "flang/eval/jit.hpp"
+#include "flang/eval/runtime_heap.hpp"
+#include "flang/flang_exception.hpp"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <initializer_list>
+#include <mutex>
+#include <optional>
+
+#if defined(__x86_64__) && defined(__linux__)
+#define FLANG_JIT_X86_64
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+namespace flang
+{
+
+#ifdef FLANG_JIT_X86_64
+
+namespace
+{
+
+// Shared by all native frames of one call from the interpreter, kept in r12
+struct JitContext {
+    int64_t depth;
+    int64_t limit;
+    void* bail_rsp;
+};
+
+const uint8_t DEPTH_OFFSET    = offsetof(JitContext, depth);
+const uint8_t LIMIT_OFFSET    = offsetof(JitContext, limit);
+const uint8_t BAIL_RSP_OFFSET = offsetof(JitContext, bail_rsp);
+
+const size_t CODE_ARENA_SIZE = 16 * 1024 * 1024;
+const size_t CODE_ALIGNMENT = 16;
+
+// Returns 1 and stores the result, or 0 if the native code bailed out
+using EntryStub = int (*)(int64_t const* args, JitContext* context, void const* code, int64_t* result);
+
+enum class JitType { Integer, Boolean };
+
+class Assembler
+{
+public:
+    void emit(std::initializer_list<uint8_t> bytes)
+    {
+        for (auto byte : bytes) {
+            code_.push_back(byte);
+        }
+    }
+
+    void emit32(int32_t value)
+    {
+        auto const* bytes = reinterpret_cast<uint8_t const*>(&value);
+        code_.insert(code_.end(), bytes, bytes + sizeof(value));
+    }
+
+    void emit64(int64_t value)
+    {
+        auto const* bytes = reinterpret_cast<uint8_t const*>(&value);
+        code_.insert(code_.end(), bytes, bytes + sizeof(value));
+    }
+
+    // Emits `opcode rel32` with the target left open, returns the position to patch
+    size_t emitJump(std::initializer_list<uint8_t> opcode)
+    {
+        emit(opcode);
+        auto fixup = code_.size();
+        emit32(0);
+        return fixup;
+    }
+
+    void bind(size_t fixup)
+    {
+        bind(fixup, code_.size());
+    }
+
+    void bind(size_t fixup, size_t target)
+    {
+        int32_t relative = static_cast<int32_t>(target) - static_cast<int32_t>(fixup + 4);
+        std::memcpy(&code_[fixup], &relative, sizeof(relative));
+    }
+
+    size_t size() const
+    {
+        return code_.size();
+    }
+
+    void truncate(size_t size)
+    {
+        code_.resize(size);
+    }
+
+    std::vector<uint8_t> const& code() const
+    {
+        return code_;
+    }
+
+private:
+    std::vector<uint8_t> code_;
+};
+
+// Executable memory. The same pages are mapped twice, writable for the
+// compiler and executable for running, so no page is ever both
+class CodeArena
+{
+public:
+    // nullptr once the arena is exhausted
+    void const* install(std::vector<uint8_t> const& code)
+    {
+        if (writable_ == nullptr && !map()) {
+            return nullptr;
+        }
+        size_t offset = (used_ + CODE_ALIGNMENT - 1) / CODE_ALIGNMENT * CODE_ALIGNMENT;
+        if (offset + code.size() > CODE_ARENA_SIZE) {
+            return nullptr;
+        }
+        std::memcpy(writable_ + offset, code.data(), code.size());
+        used_ = offset + code.size();
+        return executable_ + offset;
+    }
+
+private:
+    char* writable_         = nullptr;
+    char const* executable_ = nullptr;
+    size_t used_            = 0;
+
+    bool map()
+    {
+        int fd = memfd_create("flang-jit", MFD_CLOEXEC);
+        if (fd < 0) {
+            return false;
+        }
+        void* writable   = MAP_FAILED;
+        void* executable = MAP_FAILED;
+        if (ftruncate(fd, CODE_ARENA_SIZE) == 0) {
+            writable   = mmap(nullptr, CODE_ARENA_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+            executable = mmap(nullptr, CODE_ARENA_SIZE, PROT_READ | PROT_EXEC, MAP_SHARED, fd, 0);
+        }
+        close(fd);
+        if (writable == MAP_FAILED || executable == MAP_FAILED) {
+            return false;
+        }
+        writable_   = static_cast<char*>(writable);
+        executable_ = static_cast<char const*>(executable);
+        return true;
+    }
+};
+
+std::mutex jit_mutex;
+CodeArena code_arena;
+EntryStub entry_stub   = nullptr;
+void const* bail_stub  = nullptr;
+JitEntry const* const NOT_COMPILABLE = new JitEntry();
+
+// Saves the callee-saved registers, remembers the stack pointer for bailing
+// out and calls the compiled function with the arguments in rdi
+bool installStubs()
+{
+    Assembler a;
+    a.emit({0x53, 0x55, 0x41, 0x54, 0x41, 0x55, 0x41, 0x56, 0x41, 0x57}); // push rbx, rbp, r12-r15
+    a.emit({0x49, 0x89, 0xF4});                                           // mov r12, rsi
+    a.emit({0x49, 0x89, 0xCD});                                           // mov r13, rcx
+    a.emit({0x49, 0x89, 0x64, 0x24, BAIL_RSP_OFFSET});                    // mov [r12 + bail_rsp], rsp
+    a.emit({0xFF, 0xD2});                                                 // call rdx
+    a.emit({0x49, 0x89, 0x45, 0x00});                                     // mov [r13], rax
+    a.emit({0xB8, 0x01, 0x00, 0x00, 0x00});                               // mov eax, 1
+    auto restore = a.size();
+    a.emit({0x41, 0x5F, 0x41, 0x5E, 0x41, 0x5D, 0x41, 0x5C, 0x5D, 0x5B}); // pop r15-r12, rbp, rbx
+    a.emit({0xC3});                                                       // ret
+    auto bail = a.size();
+    a.emit({0x49, 0x8B, 0x64, 0x24, BAIL_RSP_OFFSET}); // mov rsp, [r12 + bail_rsp]
+    a.emit({0x31, 0xC0});                              // xor eax, eax
+    a.bind(a.emitJump({0xE9}), restore);               // jmp restore
+
+    auto const* code = static_cast<char const*>(code_arena.install(a.code()));
+    if (code == nullptr) {
+        return false;
+    }
+    entry_stub = reinterpret_cast<EntryStub>(code);
+    bail_stub  = code + bail;
+    return true;
+}
+
+JitEntry const* compileFunction(EnvironmentStack& env, std::shared_ptr<UserFunction> const& fn, std::vector<UserFunction const*>& in_progress);
+
+// Translates one function body, assuming recursive calls return `assumed`.
+// The body is evaluated into rax, operands are kept on the machine stack
+class FunctionCompiler
+{
+public:
+    FunctionCompiler(EnvironmentStack& env, UserFunction const& fn, JitType assumed, JitEntry& entry, std::vector<UserFunction const*>& in_progress)
+        : env_(env)
+        , fn_(fn)
+        , assumed_(assumed)
+        , entry_(entry)
+        , in_progress_(in_progress)
+    {
+    }
+
+    std::optional<JitType> compile()
+    {
+        a_.emit({0x53});                                // push rbx
+        a_.emit({0x48, 0x89, 0xFB});                    // mov rbx, rdi
+        a_.emit({0x49, 0x8B, 0x44, 0x24, DEPTH_OFFSET}); // mov rax, [r12 + depth]
+        a_.emit({0x48, 0xFF, 0xC0});                    // inc rax
+        a_.emit({0x49, 0x89, 0x44, 0x24, DEPTH_OFFSET}); // mov [r12 + depth], rax
+        a_.emit({0x49, 0x3B, 0x44, 0x24, LIMIT_OFFSET}); // cmp rax, [r12 + limit]
+        bailIf({0x0F, 0x8F});                           // jg
+
+        auto type = gen(*fn_.getBody());
+        if (!type) {
+            return std::nullopt;
+        }
+
+        a_.emit({0x49, 0xFF, 0x4C, 0x24, DEPTH_OFFSET}); // dec qword [r12 + depth]
+        a_.emit({0x5B});                                // pop rbx
+        a_.emit({0xC3});                                // ret
+
+        for (auto fixup : bail_fixups_) {
+            a_.bind(fixup);
+        }
+        a_.emit({0x48, 0xB8}); // mov rax, bail_stub
+        a_.emit64(reinterpret_cast<int64_t>(bail_stub));
+        a_.emit({0xFF, 0xE0}); // jmp rax
+        return type;
+    }
+
+    std::vector<uint8_t> const& code() const
+    {
+        return a_.code();
+    }
+
+private:
+    EnvironmentStack& env_;
+    UserFunction const& fn_;
+    JitType assumed_;
+    JitEntry& entry_;
+    std::vector<UserFunction const*>& in_progress_;
+    Assembler a_;
+    std::vector<size_t> bail_fixups_;
+
+    void bailIf(std::initializer_list<uint8_t> jcc)
+    {
+        bail_fixups_.push_back(a_.emitJump(jcc));
+    }
+
+    bool addGuard(std::string const& name, std::shared_ptr<Element> const& value)
+    {
+        for (auto const& [guard_name, guard_value] : entry_.guards) {
+            if (guard_name == name) {
+                return guard_value == value;
+            }
+        }
+        entry_.guards.emplace_back(name, value);
+        return true;
+    }
+
+    std::optional<JitType> gen(Element const& node)
+    {
+        switch (node.kind()) {
+            case ElementKind::Integer:
+                a_.emit({0x48, 0xB8}); // mov rax, imm64
+                a_.emit64(static_cast<Integer const&>(node).getValue());
+                return JitType::Integer;
+            case ElementKind::Boolean:
+                a_.emit({0xB8}); // mov eax, imm32
+                a_.emit32(static_cast<Boolean const&>(node).getValue() ? 1 : 0);
+                return JitType::Boolean;
+            case ElementKind::Identifier: {
+                auto const& formal_args = fn_.getFormalArgs();
+                auto it                 = std::find(formal_args.begin(), formal_args.end(), static_cast<Identifier const&>(node).getName());
+                if (it == formal_args.end()) {
+                    return std::nullopt;
+                }
+                a_.emit({0x48, 0x8B, 0x83}); // mov rax, [rbx + disp32]
+                a_.emit32(static_cast<int32_t>(8 * (it - formal_args.begin())));
+                return JitType::Integer;
+            }
+            case ElementKind::List:
+                return genCall(static_cast<List const&>(node).getElements());
+            default:
+                return std::nullopt;
+        }
+    }
+
+    std::optional<JitType> genCall(std::vector<std::shared_ptr<Element>> const& elements)
+    {
+        if (elements.empty() || !isa<Identifier>(*elements[0])) {
+            return std::nullopt;
+        }
+        auto const& name        = static_cast<Identifier const&>(*elements[0]).getName();
+        auto const& formal_args = fn_.getFormalArgs();
+        if (std::find(formal_args.begin(), formal_args.end(), name) != formal_args.end()) {
+            return std::nullopt;
+        }
+        auto callee = env_.loadVariable(name);
+        if (callee == nullptr || !addGuard(name, callee)) {
+            return std::nullopt;
+        }
+        auto args = Arguments(elements).subspan(1);
+        if (isa<Builtin>(*callee)) {
+            return genBuiltin(static_cast<Builtin const&>(*callee).getName(), args);
+        }
+        if (isa<UserFunction>(*callee)) {
+            return genUserCall(std::static_pointer_cast<UserFunction>(callee), args);
+        }
+        return std::nullopt;
+    }
+
+    // Left operand in rax, right operand in rcx
+    bool genOperands(Arguments args, JitType lhs_type, JitType rhs_type)
+    {
+        if (args.size() != 2 || gen(*args[0]) != lhs_type) {
+            return false;
+        }
+        a_.emit({0x50}); // push rax
+        if (gen(*args[1]) != rhs_type) {
+            return false;
+        }
+        a_.emit({0x48, 0x89, 0xC1}); // mov rcx, rax
+        a_.emit({0x58});             // pop rax
+        return true;
+    }
+
+    std::optional<JitType> genComparison(Arguments args, JitType operand_type, uint8_t setcc)
+    {
+        if (!genOperands(args, operand_type, operand_type)) {
+            return std::nullopt;
+        }
+        a_.emit({0x48, 0x39, 0xC8});  // cmp rax, rcx
+        a_.emit({0x0F, setcc, 0xC0}); // setcc al
+        a_.emit({0x0F, 0xB6, 0xC0});  // movzx eax, al
+        return JitType::Boolean;
+    }
+
+    std::optional<JitType> genBuiltin(std::string const& name, Arguments args)
+    {
+        if (name == "plus" || name == "minus" || name == "times") {
+            if (!genOperands(args, JitType::Integer, JitType::Integer)) {
+                return std::nullopt;
+            }
+            if (name == "plus") {
+                a_.emit({0x48, 0x01, 0xC8}); // add rax, rcx
+            } else if (name == "minus") {
+                a_.emit({0x48, 0x29, 0xC8}); // sub rax, rcx
+            } else {
+                a_.emit({0x48, 0x0F, 0xAF, 0xC1}); // imul rax, rcx
+            }
+            bailIf({0x0F, 0x80}); // jo
+            return JitType::Integer;
+        }
+        if (name == "divide") {
+            if (!genOperands(args, JitType::Integer, JitType::Integer)) {
+                return std::nullopt;
+            }
+            a_.emit({0x48, 0x85, 0xC9});       // test rcx, rcx
+            bailIf({0x0F, 0x84});              // jz
+            a_.emit({0x48, 0x83, 0xF9, 0xFF}); // cmp rcx, -1
+            auto not_minus_one = a_.emitJump({0x0F, 0x85}); // jne
+            a_.emit({0x48, 0xF7, 0xD8});       // neg rax
+            bailIf({0x0F, 0x80});              // jo
+            auto done = a_.emitJump({0xE9});   // jmp
+            a_.bind(not_minus_one);
+            a_.emit({0x48, 0x99});             // cqo
+            a_.emit({0x48, 0xF7, 0xF9});       // idiv rcx
+            a_.bind(done);
+            return JitType::Integer;
+        }
+        if (name == "less") {
+            return genComparison(args, JitType::Integer, 0x9C);
+        }
+        if (name == "lesseq") {
+            return genComparison(args, JitType::Integer, 0x9E);
+        }
+        if (name == "greater") {
+            return genComparison(args, JitType::Integer, 0x9F);
+        }
+        if (name == "greatereq") {
+            return genComparison(args, JitType::Integer, 0x9D);
+        }
+        if (name == "equal" || name == "nonequal") {
+            // Both operands have the same type, peek at the first one
+            if (args.size() != 2) {
+                return std::nullopt;
+            }
+            auto probe_size = a_.size();
+            auto type       = gen(*args[0]);
+            if (!type) {
+                return std::nullopt;
+            }
+            a_.truncate(probe_size);
+            std::erase_if(bail_fixups_, [probe_size](size_t fixup) { return fixup >= probe_size; });
+            return genComparison(args, *type, name == "equal" ? 0x94 : 0x95);
+        }
+        if (name == "and" || name == "or" || name == "xor") {
+            if (!genOperands(args, JitType::Boolean, JitType::Boolean)) {
+                return std::nullopt;
+            }
+            if (name == "and") {
+                a_.emit({0x48, 0x21, 0xC8}); // and rax, rcx
+            } else if (name == "or") {
+                a_.emit({0x48, 0x09, 0xC8}); // or rax, rcx
+            } else {
+                a_.emit({0x48, 0x31, 0xC8}); // xor rax, rcx
+            }
+            return JitType::Boolean;
+        }
+        if (name == "not") {
+            if (args.size() != 1 || gen(*args[0]) != JitType::Boolean) {
+                return std::nullopt;
+            }
+            a_.emit({0x48, 0x83, 0xF0, 0x01}); // xor rax, 1
+            return JitType::Boolean;
+        }
+        if (name == "cond") {
+            // Without an else branch the result type would depend on the condition
+            if (args.size() != 3 || gen(*args[0]) != JitType::Boolean) {
+                return std::nullopt;
+            }
+            a_.emit({0x48, 0x85, 0xC0}); // test rax, rax
+            auto else_branch = a_.emitJump({0x0F, 0x84}); // jz
+            auto then_type   = gen(*args[1]);
+            auto done        = a_.emitJump({0xE9}); // jmp
+            a_.bind(else_branch);
+            auto else_type = gen(*args[2]);
+            a_.bind(done);
+            if (!then_type || then_type != else_type) {
+                return std::nullopt;
+            }
+            return then_type;
+        }
+        return std::nullopt;
+    }
+
+    std::optional<JitType> genUserCall(std::shared_ptr<UserFunction> const& callee, Arguments args)
+    {
+        if (callee->isMacro() || args.size() != callee->getFormalArgs().size() || args.size() > MAX_JIT_ARGS) {
+            return std::nullopt;
+        }
+        bool is_self = callee.get() == &fn_;
+        JitType result_type;
+        JitEntry const* callee_entry = nullptr;
+        if (is_self) {
+            result_type = assumed_;
+        } else {
+            // Mutual recursion is not supported
+            if (std::find(in_progress_.begin(), in_progress_.end(), callee.get()) != in_progress_.end()) {
+                return std::nullopt;
+            }
+            callee_entry = callee->getJitEntry();
+            if (callee_entry == nullptr) {
+                callee_entry = compileFunction(env_, callee, in_progress_);
+            }
+            if (callee_entry->code == nullptr) {
+                return std::nullopt;
+            }
+            for (auto const& [name, value] : callee_entry->guards) {
+                if (!addGuard(name, value)) {
+                    return std::nullopt;
+                }
+            }
+            entry_.bound_names.insert(entry_.bound_names.end(), callee_entry->bound_names.begin(), callee_entry->bound_names.end());
+            result_type = callee_entry->returns_boolean ? JitType::Boolean : JitType::Integer;
+        }
+        // Arguments are pushed last to first, so that the first one ends up at [rsp]
+        for (size_t i = args.size(); i-- > 0;) {
+            if (gen(*args[i]) != JitType::Integer) {
+                return std::nullopt;
+            }
+            a_.emit({0x50}); // push rax
+        }
+        a_.emit({0x48, 0x89, 0xE7}); // mov rdi, rsp
+        if (is_self) {
+            a_.bind(a_.emitJump({0xE8}), 0); // call <start>
+        } else {
+            a_.emit({0x48, 0xB8}); // mov rax, code
+            a_.emit64(reinterpret_cast<int64_t>(callee_entry->code));
+            a_.emit({0xFF, 0xD0}); // call rax
+        }
+        if (!args.empty()) {
+            a_.emit({0x48, 0x81, 0xC4}); // add rsp, imm32
+            a_.emit32(static_cast<int32_t>(8 * args.size()));
+        }
+        return result_type;
+    }
+};
+
+JitEntry const* compileFunction(EnvironmentStack& env, std::shared_ptr<UserFunction> const& fn, std::vector<UserFunction const*>& in_progress)
+{
+    JitEntry const* result = NOT_COMPILABLE;
+    if (!fn->isMacro() && fn->getFormalArgs().size() <= MAX_JIT_ARGS) {
+        in_progress.push_back(fn.get());
+        for (auto assumed : {JitType::Integer, JitType::Boolean}) {
+            JitEntry entry;
+            entry.bound_names = fn->getFormalArgs();
+            FunctionCompiler compiler(env, *fn, assumed, entry, in_progress);
+            std::optional<JitType> type;
+            try {
+                type = compiler.compile();
+            } catch (flang_exception const&) {
+                // A lazily parsed body that does not parse, reported by the interpreter if it runs
+                break;
+            }
+            if (type != assumed) {
+                continue;
+            }
+            // A formal argument named like a function it calls would shadow it
+            bool shadowed = std::any_of(entry.guards.begin(), entry.guards.end(), [&entry](auto const& guard) {
+                return std::find(entry.bound_names.begin(), entry.bound_names.end(), guard.first) != entry.bound_names.end();
+            });
+            if (shadowed) {
+                break;
+            }
+            entry.code = code_arena.install(compiler.code());
+            if (entry.code != nullptr) {
+                entry.returns_boolean = assumed == JitType::Boolean;
+                result                = new JitEntry(std::move(entry));
+            }
+            break;
+        }
+        in_progress.pop_back();
+    }
+    fn->setJitEntry(result);
+    return result;
+}
+
+} // namespace
+
+bool jitSupported()
+{
+    return true;
+}
+
+std::shared_ptr<Element> jitCall(EnvironmentStack& env, std::shared_ptr<UserFunction> const& fn, Arguments args)
+{
+    auto const* entry = fn->getJitEntry();
+    if (entry == nullptr) {
+        std::lock_guard lock(jit_mutex);
+        entry = fn->getJitEntry();
+        if (entry == nullptr) {
+            std::vector<UserFunction const*> in_progress;
+            entry = (entry_stub != nullptr || installStubs()) ? compileFunction(env, fn, in_progress) : NOT_COMPILABLE;
+            fn->setJitEntry(entry);
+        }
+    }
+    if (entry->code == nullptr) {
+        return nullptr;
+    }
+
+    int64_t values[MAX_JIT_ARGS];
+    for (size_t i = 0; i < args.size(); ++i) {
+        if (!isa<Integer>(*args[i])) {
+            return nullptr;
+        }
+        values[i] = static_cast<Integer const&>(*args[i]).getValue();
+    }
+    for (auto const& [name, value] : entry->guards) {
+        if (env.loadVariable(name) != value) {
+            return nullptr;
+        }
+    }
+    // Leave room for the interpreter to report the stack overflow itself
+    int64_t limit = MAX_STACK_SIZE - static_cast<int64_t>(env.depth()) - 2;
+    if (limit <= 0) {
+        return nullptr;
+    }
+    JitContext context {0, limit, nullptr};
+    int64_t result = 0;
+    if (!entry_stub(values, &context, entry->code, &result)) {
+        return nullptr;
+    }
+    return entry->returns_boolean ? std::shared_ptr<Element>(makeBoolean(result != 0)) : std::shared_ptr<Element>(makeInteger(result));
+}
+
+#else
+
+bool jitSupported()
+{
+    return false;
+}
+
+std::shared_ptr<Element> jitCall(EnvironmentStack&, std::shared_ptr<UserFunction> const&, Arguments)
+{
+    return nullptr;
+}
+
+#endif
+
+} // namespace flang
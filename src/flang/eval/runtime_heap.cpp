@@ -0,0 +1,363 @@
+#include "flang/eval/runtime_heap.hpp"
+#include "flang/eval/future.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <new>
+#include <unordered_map>
+
+namespace flang
+{
+
+namespace
+{
+const size_t SIZE_CLASS_GRANULE = 16;
+const size_t MAX_POOLED_SIZE    = 256;
+const size_t N_SIZE_CLASSES     = MAX_POOLED_SIZE / SIZE_CLASS_GRANULE;
+const size_t CHUNK_SIZE         = 64 * 1024;
+
+struct FreeBlock {
+    FreeBlock* next;
+};
+
+std::atomic<uint64_t> reserved_bytes {0};
+std::atomic<uint64_t> live_bytes {0};
+std::atomic<uint64_t> peak_live_bytes {0};
+std::atomic<uint64_t> allocations {0};
+
+// Free lists left behind by exited threads, taken over by threads that run
+// out of blocks. Never destroyed, the blocks stay reachable until exit.
+struct OrphanedLists {
+    std::mutex mutex;
+    std::array<std::vector<FreeBlock*>, N_SIZE_CLASSES> free_lists;
+};
+
+OrphanedLists& orphanedLists()
+{
+    static auto* orphaned_lists = new OrphanedLists();
+    return *orphaned_lists;
+}
+
+// Blocks freed on a thread are reused by that thread. Chunks are never
+// returned to the system, the pools only grow up to the peak live size.
+struct ThreadPools {
+    std::array<FreeBlock*, N_SIZE_CLASSES> free_lists {};
+
+    ~ThreadPools()
+    {
+        auto& orphaned = orphanedLists();
+        std::lock_guard lock(orphaned.mutex);
+        for (size_t size_class = 0; size_class < N_SIZE_CLASSES; ++size_class) {
+            if (free_lists[size_class] != nullptr) {
+                orphaned.free_lists[size_class].push_back(free_lists[size_class]);
+            }
+        }
+    }
+};
+
+thread_local ThreadPools pools;
+
+size_t sizeClass(size_t size)
+{
+    return (size + SIZE_CLASS_GRANULE - 1) / SIZE_CLASS_GRANULE - 1;
+}
+
+bool adoptOrphanedList(size_t size_class)
+{
+    auto& orphaned = orphanedLists();
+    std::lock_guard lock(orphaned.mutex);
+    auto& lists = orphaned.free_lists[size_class];
+    if (lists.empty()) {
+        return false;
+    }
+    pools.free_lists[size_class] = lists.back();
+    lists.pop_back();
+    return true;
+}
+
+void refill(size_t size_class)
+{
+    if (adoptOrphanedList(size_class)) {
+        return;
+    }
+    size_t block_size = (size_class + 1) * SIZE_CLASS_GRANULE;
+    auto* chunk       = static_cast<char*>(::operator new(CHUNK_SIZE));
+    reserved_bytes.fetch_add(CHUNK_SIZE, std::memory_order_relaxed);
+    auto& head = pools.free_lists[size_class];
+    for (size_t offset = 0; offset + block_size <= CHUNK_SIZE; offset += block_size) {
+        auto* block = reinterpret_cast<FreeBlock*>(chunk + offset);
+        block->next = head;
+        head        = block;
+    }
+}
+
+#ifdef FLANG_ENABLE_STATS
+void countAllocation(size_t size)
+{
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    auto live = live_bytes.fetch_add(size, std::memory_order_relaxed) + size;
+    auto peak = peak_live_bytes.load(std::memory_order_relaxed);
+    while (live > peak && !peak_live_bytes.compare_exchange_weak(peak, live, std::memory_order_relaxed)) {
+    }
+}
+#endif
+
+// Collections run once the tracked containers double, but not more often
+// than every MIN_COLLECTION_THRESHOLD of them
+const size_t MIN_COLLECTION_THRESHOLD = 1024;
+
+struct TrackedContainer {
+    std::weak_ptr<Element> owner;
+    Element* element;
+};
+
+struct Collector {
+    std::mutex mutex;
+    std::vector<TrackedContainer> tracked;
+    size_t threshold = MIN_COLLECTION_THRESHOLD;
+    size_t mutators  = 0;
+};
+
+Collector& collector()
+{
+    // Never destroyed, containers may still be freed during static destruction
+    static auto* instance = new Collector();
+    return *instance;
+}
+
+std::atomic<uint64_t> collections {0};
+std::atomic<uint64_t> collected_containers {0};
+std::atomic<uint64_t> total_pause_ns {0};
+std::atomic<uint64_t> max_pause_ns {0};
+
+bool isTraced(Element const& element)
+{
+    return isa<List>(element) || isa<HashMap>(element) || isa<Array>(element) || isa<Future>(element);
+}
+
+// Calls `visit` with each reference a traced value owns
+template <class Visit>
+void forEachReference(Element const& element, Visit&& visit)
+{
+    switch (element.kind()) {
+        case ElementKind::List:
+            for (auto const& child : static_cast<List const&>(element).getElements()) {
+                visit(child);
+            }
+            break;
+        case ElementKind::HashMap:
+            for (auto const& [key, value] : static_cast<HashMap const&>(element).getEntries()) {
+                visit(key);
+                visit(value);
+            }
+            break;
+        case ElementKind::Array:
+            for (auto const& child : static_cast<Array const&>(element).getElements()) {
+                visit(child);
+            }
+            break;
+        case ElementKind::Future: {
+            // A task that is queued or running is also owned by the pool
+            auto const& task = static_cast<Future const&>(element).getTask();
+            if (task.use_count() == 1 && task->state.load() == FutureTask::Done) {
+                visit(task->expression);
+                visit(task->value);
+            }
+            break;
+        }
+        default:
+            break;
+    }
+}
+
+void pruneFreedContainers(Collector& heap)
+{
+    std::erase_if(heap.tracked, [](TrackedContainer const& container) { return container.owner.expired(); });
+}
+
+// Hash maps and arrays unreachable from the roots
+std::vector<std::shared_ptr<Element>> findGarbage(Collector& heap)
+{
+    struct Node {
+        // References from outside the traced values
+        long roots;
+        bool marked = false;
+    };
+    std::unordered_map<Element const*, Node> nodes;
+    std::vector<Element const*> pending;
+    for (auto const& container : heap.tracked) {
+        nodes.emplace(container.element, Node {container.owner.use_count()});
+        pending.push_back(container.element);
+    }
+    while (!pending.empty()) {
+        auto const* element = pending.back();
+        pending.pop_back();
+        forEachReference(*element, [&](std::shared_ptr<Element> const& child) {
+            if (child == nullptr || !isTraced(*child)) {
+                return;
+            }
+            auto [it, inserted] = nodes.try_emplace(child.get(), Node {child.use_count()});
+            it->second.roots--;
+            if (inserted) {
+                pending.push_back(child.get());
+            }
+        });
+    }
+
+    for (auto& [element, node] : nodes) {
+        if (node.roots > 0) {
+            node.marked = true;
+            pending.push_back(element);
+        }
+    }
+    while (!pending.empty()) {
+        auto const* element = pending.back();
+        pending.pop_back();
+        forEachReference(*element, [&](std::shared_ptr<Element> const& child) {
+            if (child == nullptr || !isTraced(*child)) {
+                return;
+            }
+            auto& node = nodes.at(child.get());
+            if (!node.marked) {
+                node.marked = true;
+                pending.push_back(child.get());
+            }
+        });
+    }
+
+    std::vector<std::shared_ptr<Element>> garbage;
+    std::erase_if(heap.tracked, [&](TrackedContainer const& container) {
+        if (nodes.at(container.element).marked) {
+            return false;
+        }
+        // Freed meanwhile by a thread dropping its last reference
+        if (auto owner = container.owner.lock()) {
+            garbage.push_back(std::move(owner));
+        }
+        return true;
+    });
+    return garbage;
+}
+} // namespace
+
+void* heapAllocate(size_t size)
+{
+    FLANG_STATS(countAllocation(size));
+    if (size > MAX_POOLED_SIZE) {
+        return ::operator new(size);
+    }
+    auto size_class = sizeClass(size);
+    auto& head      = pools.free_lists[size_class];
+    if (head == nullptr) {
+        refill(size_class);
+    }
+    auto* block = head;
+    head        = block->next;
+    return block;
+}
+
+void heapDeallocate(void* pointer, size_t size)
+{
+    FLANG_STATS(live_bytes.fetch_sub(size, std::memory_order_relaxed));
+    if (size > MAX_POOLED_SIZE) {
+        ::operator delete(pointer);
+        return;
+    }
+    auto& head  = pools.free_lists[sizeClass(size)];
+    auto* block = static_cast<FreeBlock*>(pointer);
+    block->next = head;
+    head        = block;
+}
+
+HeapMutator::HeapMutator()
+{
+    auto& heap = collector();
+    std::lock_guard lock(heap.mutex);
+    heap.mutators++;
+}
+
+HeapMutator::~HeapMutator()
+{
+    auto& heap = collector();
+    std::lock_guard lock(heap.mutex);
+    heap.mutators--;
+}
+
+void trackContainer(std::shared_ptr<Element> const& container)
+{
+    auto& heap = collector();
+    std::lock_guard lock(heap.mutex);
+    heap.tracked.push_back({container, container.get()});
+    if (heap.tracked.size() >= heap.threshold) {
+        collection_requested.store(true, std::memory_order_relaxed);
+    }
+}
+
+void collectGarbage()
+{
+    auto& heap = collector();
+    std::lock_guard lock(heap.mutex);
+    collection_requested.store(false, std::memory_order_relaxed);
+    pruneFreedContainers(heap);
+    if (heap.mutators > 1) {
+        heap.threshold = std::max(MIN_COLLECTION_THRESHOLD, 2 * heap.tracked.size());
+        return;
+    }
+
+    auto start   = std::chrono::steady_clock::now();
+    auto garbage = findGarbage(heap);
+    // All of them stay alive until each is emptied
+    for (auto const& container : garbage) {
+        if (isa<HashMap>(*container)) {
+            static_cast<HashMap&>(*container).getEntries().clear();
+        } else {
+            static_cast<Array&>(*container).getElements().clear();
+        }
+    }
+    collected_containers.fetch_add(garbage.size(), std::memory_order_relaxed);
+    garbage.clear();
+    heap.threshold = std::max(MIN_COLLECTION_THRESHOLD, 2 * heap.tracked.size());
+
+    uint64_t pause = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+    collections.fetch_add(1, std::memory_order_relaxed);
+    total_pause_ns.fetch_add(pause, std::memory_order_relaxed);
+    max_pause_ns.store(std::max(max_pause_ns.load(std::memory_order_relaxed), pause), std::memory_order_relaxed);
+}
+
+HeapStatistics heapStatistics()
+{
+    size_t tracked_containers = 0;
+    {
+        auto& heap = collector();
+        std::lock_guard lock(heap.mutex);
+        pruneFreedContainers(heap);
+        tracked_containers = heap.tracked.size();
+    }
+    return {
+        .reserved_bytes       = reserved_bytes.load(std::memory_order_relaxed),
+        .live_bytes           = live_bytes.load(std::memory_order_relaxed),
+        .peak_live_bytes      = peak_live_bytes.load(std::memory_order_relaxed),
+        .allocations          = allocations.load(std::memory_order_relaxed),
+        .tracked_containers   = tracked_containers,
+        .collections          = collections.load(std::memory_order_relaxed),
+        .collected_containers = collected_containers.load(std::memory_order_relaxed),
+        .total_pause_ns       = total_pause_ns.load(std::memory_order_relaxed),
+        .max_pause_ns         = max_pause_ns.load(std::memory_order_relaxed),
+    };
+}
+
+InternedValues::InternedValues()
+    : true_value(std::make_shared<Boolean>(true))
+    , false_value(std::make_shared<Boolean>(false))
+    , null_value(std::make_shared<Null>())
+{
+    for (auto value = MIN_INTERNED_INTEGER; value <= MAX_INTERNED_INTEGER; ++value) {
+        small_integers.push_back(std::make_shared<Integer>(value));
+    }
+}
+
+InternedValues const interned_values;
+
+} // namespace flang
@@ -0,0 +1,263 @@
+#include "flang/eval/scheduler.hpp"
+#include "flang/eval/eval_visitor.hpp"
+#include "flang/flang_exception.hpp"
+#include "flang/profile/shadow_stack.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <ctime>
+#include <new>
+#include <sys/mman.h>
+#include <ucontext.h>
+#include <unistd.h>
+
+#if defined(__SANITIZE_ADDRESS__)
+#define FLANG_ASAN_FIBERS
+#elif defined(__has_feature)
+#if __has_feature(address_sanitizer)
+#define FLANG_ASAN_FIBERS
+#endif
+#endif
+
+#ifdef FLANG_ASAN_FIBERS
+#include <sanitizer/common_interface_defs.h>
+#endif
+
+namespace flang
+{
+
+namespace
+{
+std::chrono::nanoseconds threadCpuTime()
+{
+    timespec time {};
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &time);
+    return std::chrono::seconds(time.tv_sec) + std::chrono::nanoseconds(time.tv_nsec);
+}
+
+// Stack the context switched to, announced to AddressSanitizer
+struct StackBounds {
+    void const* bottom = nullptr;
+    size_t size        = 0;
+};
+
+// Saves the current context in `from` and resumes `to`. Returns the stack
+// of whoever switched back to `from`
+StackBounds switchContext(ucontext_t* from, ucontext_t* to, [[maybe_unused]] StackBounds to_stack)
+{
+    StackBounds resumed_from;
+#ifdef FLANG_ASAN_FIBERS
+    void* fake_stack = nullptr;
+    __sanitizer_start_switch_fiber(&fake_stack, to_stack.bottom, to_stack.size);
+#endif
+    swapcontext(from, to);
+#ifdef FLANG_ASAN_FIBERS
+    __sanitizer_finish_switch_fiber(fake_stack, &resumed_from.bottom, &resumed_from.size);
+#endif
+    return resumed_from;
+}
+} // namespace
+
+struct Scheduler::Script {
+    Scheduler* scheduler;
+    ScriptReport report;
+    Program program;
+    std::streambuf* output;
+    std::string data_directory;
+
+    // Fiber stack with a guard page below it, mapped on the first time slice
+    char* stack_mapping       = nullptr;
+    size_t stack_mapping_size = 0;
+    ucontext_t context {};
+    // Worker that resumed the script last, the script switches back to it
+    ucontext_t* worker_context = nullptr;
+    StackBounds worker_stack;
+    // Shadow stack of the script's evaluator, installed for the sampling profiler
+    ShadowStack* shadow_stack = nullptr;
+    bool finished             = false;
+
+    StackBounds stack() const
+    {
+        size_t guard = sysconf(_SC_PAGESIZE);
+        return {stack_mapping + guard, stack_mapping_size - guard};
+    }
+
+    void mapStack()
+    {
+        size_t guard       = sysconf(_SC_PAGESIZE);
+        stack_mapping_size = DEFAULT_FIBER_STACK_SIZE + guard;
+        void* mapping      = mmap(nullptr, stack_mapping_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_STACK, -1, 0);
+        if (mapping == MAP_FAILED) {
+            throw std::bad_alloc();
+        }
+        stack_mapping = static_cast<char*>(mapping);
+        mprotect(stack_mapping, guard, PROT_NONE);
+
+        getcontext(&context);
+        context.uc_stack.ss_sp   = stack_mapping + guard;
+        context.uc_stack.ss_size = DEFAULT_FIBER_STACK_SIZE;
+        context.uc_link          = nullptr;
+        auto address             = reinterpret_cast<uintptr_t>(this);
+        // makecontext only passes int arguments
+        makecontext(&context, reinterpret_cast<void (*)()>(&Script::entry), 2, static_cast<unsigned>(address >> 32), static_cast<unsigned>(address));
+    }
+
+    void unmapStack()
+    {
+        munmap(stack_mapping, stack_mapping_size);
+        stack_mapping = nullptr;
+    }
+
+    static void entry(unsigned high, unsigned low)
+    {
+        auto* script = reinterpret_cast<Script*>((static_cast<uintptr_t>(high) << 32) | low);
+#ifdef FLANG_ASAN_FIBERS
+        __sanitizer_finish_switch_fiber(nullptr, &script->worker_stack.bottom, &script->worker_stack.size);
+#endif
+        script->run();
+        script->finished = true;
+#ifdef FLANG_ASAN_FIBERS
+        __sanitizer_start_switch_fiber(nullptr, script->worker_stack.bottom, script->worker_stack.size);
+#endif
+        setcontext(script->worker_context);
+    }
+
+    void run()
+    {
+        try {
+            EvalVisitor visitor(0, output);
+            if (scheduler->jit_enabled_) {
+                visitor.enableJit();
+            }
+            for (auto const& [name, path] : scheduler->data_files_) {
+                visitor.addDataFile(name, path);
+            }
+            visitor.setDataDirectory(data_directory);
+            visitor.setYieldHook(scheduler->fuel_, [this] { yield(); });
+            visitor.visitProgram(std::move(program));
+        } catch (flang_exception const& e) {
+            report.error = e.what();
+        } catch (std::exception const& e) {
+            // Nothing may unwind past the fiber entry
+            report.error = e.what();
+        }
+    }
+
+    void yield()
+    {
+        shadow_stack = ShadowStack::current();
+        worker_stack = switchContext(&context, worker_context, worker_stack);
+    }
+};
+
+Scheduler::Scheduler(size_t n_threads, size_t fuel)
+    : n_threads_(std::max<size_t>(n_threads, 1))
+    , fuel_(fuel)
+{
+}
+
+Scheduler::~Scheduler() = default;
+
+void Scheduler::enableJit()
+{
+    jit_enabled_ = true;
+}
+
+void Scheduler::addDataFile(std::string const& name, std::string path)
+{
+    data_files_.emplace_back(name, std::move(path));
+}
+
+void Scheduler::submit(std::string name, Program program, std::streambuf* output, std::string data_directory)
+{
+    auto script            = std::make_unique<Script>();
+    script->scheduler      = this;
+    script->report.name    = std::move(name);
+    script->program        = std::move(program);
+    script->output         = output;
+    script->data_directory = std::move(data_directory);
+    std::lock_guard lock(mutex_);
+    ready_.push_back(script.get());
+    ++unfinished_;
+    scripts_.push_back(std::move(script));
+}
+
+Scheduler::Script* Scheduler::takeReady()
+{
+    std::unique_lock lock(mutex_);
+    ready_cv_.wait(lock, [this] { return !ready_.empty() || unfinished_ == 0; });
+    if (ready_.empty()) {
+        return nullptr;
+    }
+    auto* script = ready_.front();
+    ready_.pop_front();
+    return script;
+}
+
+void Scheduler::finishSlice(Script* script)
+{
+    if (script->finished) {
+        script->unmapStack();
+        std::lock_guard lock(mutex_);
+        if (--unfinished_ == 0) {
+            ready_cv_.notify_all();
+        }
+        return;
+    }
+    // Back of the queue, so every ready script gets a slice in turn
+    std::lock_guard lock(mutex_);
+    ready_.push_back(script);
+    ready_cv_.notify_one();
+}
+
+void Scheduler::workerLoop()
+{
+    ucontext_t worker_context;
+    while (auto* script = takeReady()) {
+        if (script->stack_mapping == nullptr) {
+            script->mapStack();
+        }
+        script->worker_context = &worker_context;
+        auto start             = threadCpuTime();
+        {
+            ShadowStack::Activation activation(script->shadow_stack);
+            switchContext(&worker_context, &script->context, script->stack());
+        }
+        script->report.cpu_time += threadCpuTime() - start;
+        script->report.slices++;
+        finishSlice(script);
+    }
+}
+
+std::vector<ScriptReport> Scheduler::run()
+{
+    std::vector<std::thread> workers;
+    for (size_t i = 1; i < std::min(n_threads_, scripts_.size()); ++i) {
+        workers.emplace_back(&Scheduler::workerLoop, this);
+    }
+    workerLoop();
+    for (auto& worker : workers) {
+        worker.join();
+    }
+
+    std::vector<ScriptReport> reports;
+    for (auto& script : scripts_) {
+        reports.push_back(std::move(script->report));
+    }
+    scripts_.clear();
+    return reports;
+}
+
+void printScriptReports(std::ostream& os, std::vector<ScriptReport> const& reports)
+{
+    os << "----- flang scripts -----\n";
+    for (auto const& report : reports) {
+        os << "  " << report.name << ": " << std::chrono::duration<double, std::milli>(report.cpu_time).count() << " ms CPU, " << report.slices << " slices";
+        if (!report.error.empty()) {
+            os << ", ERROR: " << report.error;
+        }
+        os << "\n";
+    }
+}
+
+} // namespace flang
@@ -0,0 +1,123 @@
+#include "flang/eval/sequence.hpp"
+#include "flang/eval/eval_visitor.hpp"
+#include "flang/eval/runtime_heap.hpp"
+
+namespace flang
+{
+
+namespace
+{
+// Next element of the pipeline after `cursor`, which is moved past it.
+// nullptr at the end
+std::shared_ptr<Element> pull(EvalVisitor& visitor, SequencePipeline const& pipeline, SequenceCursor& cursor)
+{
+    // No element gets past a Take stage that let its limit through
+    size_t take_index = 0;
+    for (auto const& stage : pipeline.stages) {
+        if (stage.kind == SequenceStage::Take && cursor.taken[take_index++] == stage.limit) {
+            return nullptr;
+        }
+    }
+    while (true) {
+        std::shared_ptr<Element> value;
+        if (pipeline.list != nullptr) {
+            auto const& elements = pipeline.list->getElements();
+            if (cursor.position >= static_cast<int64_t>(elements.size())) {
+                return nullptr;
+            }
+            value = elements[cursor.position++];
+        } else {
+            if (pipeline.bounded && (pipeline.step > 0 ? cursor.position >= pipeline.end : cursor.position <= pipeline.end)) {
+                return nullptr;
+            }
+            value = makeInteger(cursor.position);
+            cursor.position += pipeline.step;
+        }
+
+        bool passed = true;
+        take_index  = 0;
+        for (auto const& stage : pipeline.stages) {
+            switch (stage.kind) {
+                case SequenceStage::Map:
+                    value = visitor.callFunction(stage.function, {&value, 1});
+                    break;
+                case SequenceStage::Filter:
+                    passed = visitor.requireBoolean(visitor.callFunction(stage.function, {&value, 1}))->getValue();
+                    break;
+                case SequenceStage::Take:
+                    // Elements a later stage rejected count as well
+                    if (cursor.taken[take_index] == stage.limit) {
+                        return nullptr;
+                    }
+                    cursor.taken[take_index++]++;
+                    break;
+            }
+            if (!passed) {
+                break;
+            }
+        }
+        if (passed) {
+            return value;
+        }
+    }
+}
+} // namespace
+
+std::shared_ptr<Element> const& Sequence::first(EvalVisitor& visitor) const
+{
+    // An error leaves the flag unset, so the next call pulls again
+    std::call_once(pulled_, [this, &visitor] {
+        rest_  = cursor_;
+        first_ = pull(visitor, *pipeline_, rest_);
+    });
+    return first_;
+}
+
+SequenceCursor const& Sequence::rest(EvalVisitor& visitor) const
+{
+    first(visitor);
+    return rest_;
+}
+
+std::shared_ptr<Sequence> makeRange(int64_t start, std::optional<int64_t> end, int64_t step)
+{
+    auto pipeline     = std::make_shared<SequencePipeline>();
+    pipeline->end     = end.value_or(0);
+    pipeline->step    = step;
+    pipeline->bounded = end.has_value();
+    return allocateValue<Sequence>(std::move(pipeline), SequenceCursor {start, {}});
+}
+
+std::shared_ptr<Sequence> addSequenceStage(std::shared_ptr<Element> const& source, SequenceStage stage)
+{
+    std::shared_ptr<SequencePipeline> pipeline;
+    SequenceCursor cursor;
+    if (isa<Sequence>(*source)) {
+        auto const& sequence = static_cast<Sequence const&>(*source);
+        pipeline             = std::make_shared<SequencePipeline>(*sequence.getPipeline());
+        cursor               = sequence.getCursor();
+    } else {
+        pipeline       = std::make_shared<SequencePipeline>();
+        pipeline->list = std::static_pointer_cast<List>(source);
+    }
+    if (stage.kind == SequenceStage::Take) {
+        cursor.taken.push_back(0);
+    }
+    pipeline->stages.push_back(std::move(stage));
+    return allocateValue<Sequence>(std::move(pipeline), std::move(cursor));
+}
+
+std::shared_ptr<Sequence> sequenceRest(EvalVisitor& visitor, Sequence const& sequence)
+{
+    return allocateValue<Sequence>(sequence.getPipeline(), sequence.rest(visitor));
+}
+
+void forEachElement(EvalVisitor& visitor, Sequence const& sequence, std::function<void(std::shared_ptr<Element>)> const& consume)
+{
+    auto cursor = sequence.getCursor();
+    while (auto element = pull(visitor, *sequence.getPipeline(), cursor)) {
+        consume(std::move(element));
+    }
+}
+
+} // namespace flang
@@ -6,11 +6,76 @@ namespace flang
 void Visitor::visitProgram(Program program)
 {
     for (auto& node : program) {
-        node->accept(*this);
+        visitElement(node);
     }
 }
 
-bool isReservedKeyword(std::string s)
+void Visitor::visitElement(std::shared_ptr<Element> const& node)
+{
+    switch (node->kind()) {
+        case ElementKind::Identifier:
+            return visitIdentifier(std::static_pointer_cast<Identifier>(node));
+        case ElementKind::Integer:
+            return visitInteger(std::static_pointer_cast<Integer>(node));
+        case ElementKind::Real:
+            return visitReal(std::static_pointer_cast<Real>(node));
+        case ElementKind::Boolean:
+            return visitBoolean(std::static_pointer_cast<Boolean>(node));
+        case ElementKind::Null:
+            return visitNull(std::static_pointer_cast<Null>(node));
+        case ElementKind::List:
+            return visitList(std::static_pointer_cast<List>(node));
+        case ElementKind::UserFunction:
+            return visitUserFunction(std::static_pointer_cast<UserFunction>(node));
+        case ElementKind::Builtin:
+            return visitBuiltin(std::static_pointer_cast<Builtin>(node));
+        case ElementKind::HashMap:
+            return visitHashMap(std::static_pointer_cast<HashMap>(node));
+        case ElementKind::LazyBody:
+            return visitLazyBody(std::static_pointer_cast<LazyBody>(node));
+        case ElementKind::Sequence:
+            return visitSequence(std::static_pointer_cast<Sequence>(node));
+        case ElementKind::Future:
+            return visitFuture(std::static_pointer_cast<Future>(node));
+        case ElementKind::Array:
+            return visitArray(std::static_pointer_cast<Array>(node));
+    }
+}
+
+char const* kindName(ElementKind kind)
+{
+    switch (kind) {
+        case ElementKind::Identifier:
+            return "Identifier";
+        case ElementKind::Integer:
+            return "Integer";
+        case ElementKind::Real:
+            return "Real";
+        case ElementKind::Boolean:
+            return "Boolean";
+        case ElementKind::Null:
+            return "Null";
+        case ElementKind::List:
+            return "List";
+        case ElementKind::UserFunction:
+            return "UserFunction";
+        case ElementKind::Builtin:
+            return "Builtin";
+        case ElementKind::HashMap:
+            return "HashMap";
+        case ElementKind::LazyBody:
+            return "LazyBody";
+        case ElementKind::Sequence:
+            return "Sequence";
+        case ElementKind::Future:
+            return "Future";
+        case ElementKind::Array:
+            return "Array";
+    }
+    return "?";
+}
+
+bool isReservedKeyword(std::string const& s)
 {
     return s == "quote" || s == "setq" || s == "func" || s == "lambda" || s == "prog" || s == "cond" || s == "while" || s == "return" || s == "break";
 }
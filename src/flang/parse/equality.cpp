@@ -0,0 +1,164 @@
+#include "flang/parse/equality.hpp"
+
+#include <functional>
+#include <utility>
+#include <vector>
+
+namespace flang
+{
+
+namespace
+{
+const size_t NULL_HASH = 0x6e756c6c;
+
+size_t combineHash(size_t seed, size_t hash)
+{
+    return seed ^ (hash + 0x9e3779b97f4a7c15 + (seed << 6) + (seed >> 2));
+}
+
+bool isNil(Element const& element)
+{
+    return isa<Null>(element) || (isa<List>(element) && static_cast<List const&>(element).getElements().empty());
+}
+
+// Hash of an element whose sublists already have their hash cached
+size_t hashAtom(Element const& element)
+{
+    auto kind_hash = static_cast<size_t>(element.kind());
+    switch (element.kind()) {
+        case ElementKind::Identifier:
+            return combineHash(kind_hash, std::hash<std::string>()(static_cast<Identifier const&>(element).getName()));
+        case ElementKind::Integer:
+            return combineHash(kind_hash, std::hash<Integer::internal_type_t>()(static_cast<Integer const&>(element).getValue()));
+        case ElementKind::Real:
+            return combineHash(kind_hash, std::hash<Real::internal_type_t>()(static_cast<Real const&>(element).getValue()));
+        case ElementKind::Boolean:
+            return combineHash(kind_hash, static_cast<Boolean const&>(element).getValue());
+        case ElementKind::Null:
+            return NULL_HASH;
+        case ElementKind::List:
+            return static_cast<List const&>(element).getHash();
+        case ElementKind::UserFunction:
+        case ElementKind::Builtin:
+        case ElementKind::HashMap:
+        case ElementKind::LazyBody:
+        case ElementKind::Sequence:
+        case ElementKind::Future:
+        case ElementKind::Array:
+            return combineHash(kind_hash, std::hash<Element const*>()(&element));
+    }
+    return kind_hash;
+}
+} // namespace
+
+size_t List::getHash() const
+{
+    auto hash = hash_.load(std::memory_order_relaxed);
+    if (hash != NO_HASH) {
+        return hash;
+    }
+    // Post-order walk over the sublists that are not hashed yet
+    std::vector<List const*> stack {this};
+    while (!stack.empty()) {
+        auto const* list = stack.back();
+        if (list->hash_.load(std::memory_order_relaxed) != NO_HASH) {
+            stack.pop_back();
+            continue;
+        }
+        bool children_ready = true;
+        for (auto const& element : list->elements_) {
+            if (isa<List>(*element) && static_cast<List const&>(*element).hash_.load(std::memory_order_relaxed) == NO_HASH) {
+                stack.push_back(static_cast<List const*>(element.get()));
+                children_ready = false;
+            }
+        }
+        if (!children_ready) {
+            continue;
+        }
+        size_t list_hash = NULL_HASH;
+        if (!list->elements_.empty()) {
+            list_hash = list->elements_.size();
+            for (auto const& element : list->elements_) {
+                list_hash = combineHash(list_hash, hashAtom(*element));
+            }
+        }
+        list->hash_.store(list_hash == NO_HASH ? 1 : list_hash, std::memory_order_relaxed);
+        stack.pop_back();
+    }
+    return hash_.load(std::memory_order_relaxed);
+}
+
+size_t HashMap::KeyHash::operator()(std::shared_ptr<Element> const& key) const
+{
+    return hashElement(*key);
+}
+
+bool HashMap::KeyEqual::operator()(std::shared_ptr<Element> const& lhs, std::shared_ptr<Element> const& rhs) const
+{
+    return elementsEqual(*lhs, *rhs);
+}
+
+size_t hashElement(Element const& element)
+{
+    return hashAtom(element);
+}
+
+bool elementsEqual(Element const& lhs, Element const& rhs)
+{
+    std::vector<std::pair<Element const*, Element const*>> pending {{&lhs, &rhs}};
+    while (!pending.empty()) {
+        auto [a, b] = pending.back();
+        pending.pop_back();
+        if (a == b) {
+            continue;
+        }
+        if (isNil(*a) || isNil(*b)) {
+            if (isNil(*a) && isNil(*b)) {
+                continue;
+            }
+            return false;
+        }
+        if (a->kind() != b->kind()) {
+            return false;
+        }
+        switch (a->kind()) {
+            case ElementKind::Identifier:
+                if (static_cast<Identifier const&>(*a).getName() != static_cast<Identifier const&>(*b).getName()) {
+                    return false;
+                }
+                break;
+            case ElementKind::Integer:
+                if (static_cast<Integer const&>(*a).getValue() != static_cast<Integer const&>(*b).getValue()) {
+                    return false;
+                }
+                break;
+            case ElementKind::Real:
+                if (static_cast<Real const&>(*a).getValue() != static_cast<Real const&>(*b).getValue()) {
+                    return false;
+                }
+                break;
+            case ElementKind::Boolean:
+                if (static_cast<Boolean const&>(*a).getValue() != static_cast<Boolean const&>(*b).getValue()) {
+                    return false;
+                }
+                break;
+            case ElementKind::List: {
+                auto const& a_elements = static_cast<List const&>(*a).getElements();
+                auto const& b_elements = static_cast<List const&>(*b).getElements();
+                if (a_elements.size() != b_elements.size() || static_cast<List const&>(*a).getHash() != static_cast<List const&>(*b).getHash()) {
+                    return false;
+                }
+                for (size_t i = 0; i < a_elements.size(); ++i) {
+                    pending.emplace_back(a_elements[i].get(), b_elements[i].get());
+                }
+                break;
+            }
+            default:
+                // Null is handled above, functions, maps, arrays, unparsed bodies, sequences and futures are equal only to themselves
+                return false;
+        }
+    }
+    return true;
+}
+
+} // namespace flang
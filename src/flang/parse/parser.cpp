@@ -1,7 +1,17 @@
+#include "flang/parse/parser.hpp"
 #include "flang/parse/ast.hpp"
+#include "flang/parse/structural_index.hpp"
 #include "flang/tokenize/token.hpp"
+#include "flang/tokenize/tokenizer.hpp"
 #include "parser_impl.hpp"
 
+#include <algorithm>
+#include <cctype>
+#include <exception>
+#include <functional>
+#include <iterator>
+#include <thread>
+
 namespace flang
 {
 
@@ -9,4 +19,305 @@ Program parse(std::vector<Token> const& tokens)
 {
     return ParserImpl(tokens).parseProgram();
 }
+
+namespace
+{
+struct Chunk {
+    size_t begin;
+    size_t end;
+    size_t first_line;
+    Program program;
+    // Tokenizer errors are reported before parser errors, as in the sequential front end
+    std::exception_ptr tokenizer_error;
+    std::exception_ptr parser_error;
+};
+
+// Cuts at the boundaries closest to equal shares of the source
+std::vector<Chunk> splitSource(std::string const& source, size_t n_chunks)
+{
+    auto boundaries = findFormBoundaries(source);
+    std::vector<Chunk> chunks;
+    size_t begin = 0;
+    size_t line  = 0;
+    auto next    = boundaries.begin();
+    for (size_t i = 1; i < n_chunks; ++i) {
+        size_t target = source.size() / n_chunks * i;
+        while (next != boundaries.end() && next->offset < target) {
+            ++next;
+        }
+        if (next == boundaries.end()) {
+            break;
+        }
+        if (next->offset > begin && next->offset < source.size()) {
+            chunks.push_back({begin, next->offset, line, {}, nullptr, nullptr});
+            begin = next->offset;
+            line  = next->line;
+        }
+    }
+    chunks.push_back({begin, source.size(), line, {}, nullptr, nullptr});
+    return chunks;
+}
+
+void parseChunk(std::string const& source, Chunk& chunk)
+{
+    std::vector<Token> tokens;
+    try {
+        tokens = Tokenizer().tokenize(source.substr(chunk.begin, chunk.end - chunk.begin), chunk.first_line);
+    } catch (...) {
+        chunk.tokenizer_error = std::current_exception();
+        return;
+    }
+    try {
+        chunk.program = parse(tokens);
+    } catch (...) {
+        chunk.parser_error = std::current_exception();
+    }
+}
+} // namespace
+
+Program parseSource(std::string const& source, size_t n_threads)
+{
+    if (source.size() < PARALLEL_PARSE_MIN_SIZE || n_threads <= 1) {
+        return parse(Tokenizer().tokenize(source));
+    }
+    auto chunks = splitSource(source, n_threads);
+    std::vector<std::thread> workers;
+    for (size_t i = 1; i < chunks.size(); ++i) {
+        workers.emplace_back(parseChunk, std::cref(source), std::ref(chunks[i]));
+    }
+    parseChunk(source, chunks[0]);
+    for (auto& worker : workers) {
+        worker.join();
+    }
+
+    for (auto const& chunk : chunks) {
+        if (chunk.tokenizer_error) {
+            std::rethrow_exception(chunk.tokenizer_error);
+        }
+    }
+    size_t n_forms = 0;
+    for (auto const& chunk : chunks) {
+        if (chunk.parser_error) {
+            std::rethrow_exception(chunk.parser_error);
+        }
+        n_forms += chunk.program.size();
+    }
+    Program program;
+    program.reserve(n_forms);
+    for (auto& chunk : chunks) {
+        std::move(chunk.program.begin(), chunk.program.end(), std::back_inserter(program));
+    }
+    return program;
+}
+
+namespace
+{
+bool isDelimiter(char c)
+{
+    return std::isspace(static_cast<unsigned char>(c)) || c == '(' || c == ')' || c == '\'';
+}
+
+// Steps over top-level forms by their parentheses only, without tokenizing them
+class FormScanner
+{
+public:
+    explicit FormScanner(std::string const& source)
+        : source_(source)
+    {
+    }
+
+    size_t position() const
+    {
+        return position_;
+    }
+
+    size_t line() const
+    {
+        return line_;
+    }
+
+    bool atEnd() const
+    {
+        return position_ == source_.size();
+    }
+
+    void reset(size_t position, size_t line)
+    {
+        position_ = position;
+        line_     = line;
+    }
+
+    void skipSpace()
+    {
+        for (; !atEnd() && std::isspace(static_cast<unsigned char>(source_[position_])); ++position_) {
+            line_ += source_[position_] == '\n';
+        }
+    }
+
+    // False if the element is not terminated before the end of the source
+    bool skipElement()
+    {
+        skipSpace();
+        while (!atEnd() && source_[position_] == '\'') {
+            ++position_;
+            skipSpace();
+        }
+        if (atEnd() || source_[position_] == ')') {
+            return false;
+        }
+        if (source_[position_] != '(') {
+            while (!atEnd() && !isDelimiter(source_[position_])) {
+                ++position_;
+            }
+            return true;
+        }
+        size_t depth = 0;
+        for (; !atEnd(); ++position_) {
+            char c = source_[position_];
+            if (c == '(') {
+                ++depth;
+            } else if (c == ')' && --depth == 0) {
+                ++position_;
+                return true;
+            } else if (c == '\n') {
+                ++line_;
+            }
+        }
+        return false;
+    }
+
+    bool skipChar(char c)
+    {
+        skipSpace();
+        if (atEnd() || source_[position_] != c) {
+            return false;
+        }
+        ++position_;
+        return true;
+    }
+
+    // Empty if the next element is not an atom
+    std::string_view takeAtom()
+    {
+        skipSpace();
+        size_t begin = position_;
+        while (!atEnd() && !isDelimiter(source_[position_])) {
+            ++position_;
+        }
+        return std::string_view(source_).substr(begin, position_ - begin);
+    }
+
+private:
+    std::string const& source_;
+    size_t position_ = 0;
+    size_t line_     = 0;
+};
+
+// Either a piece of source parsed as usual or a function definition with a lazy body
+struct Segment {
+    size_t begin;
+    size_t end;
+    size_t first_line;
+    std::shared_ptr<Element> definition;
+};
+
+// Whether the tokenizer reads `atom` as a single identifier: keyword
+// literals are matched first, also as a prefix
+bool isPlainIdentifier(std::string_view atom)
+{
+    if (atom.empty() || !std::isalpha(static_cast<unsigned char>(atom[0])) || atom.starts_with("true") || atom.starts_with("false") || atom.starts_with("null")) {
+        return false;
+    }
+    return std::all_of(atom.begin(), atom.end(), [](char c) { return std::isalnum(static_cast<unsigned char>(c)); });
+}
+
+// Builds `(func name (args) <lazy body>)` if the form at the scanner position
+// has exactly that shape, otherwise leaves the scanner anywhere inside it
+std::shared_ptr<Element> scanFunction(FormScanner& scanner, std::shared_ptr<std::string const> const& source)
+{
+    if (!scanner.skipChar('(') || scanner.takeAtom() != "func") {
+        return nullptr;
+    }
+    auto name = scanner.takeAtom();
+    if (!isPlainIdentifier(name) || !scanner.skipChar('(')) {
+        return nullptr;
+    }
+    std::vector<std::shared_ptr<Element>> formal_args;
+    while (!scanner.skipChar(')')) {
+        auto arg = scanner.takeAtom();
+        if (!isPlainIdentifier(arg)) {
+            return nullptr;
+        }
+        formal_args.push_back(std::make_shared<Identifier>(std::string(arg)));
+    }
+    scanner.skipSpace();
+    size_t body_begin = scanner.position();
+    size_t body_line  = scanner.line();
+    if (scanner.atEnd() || (*source)[body_begin] != '(' || !scanner.skipElement()) {
+        return nullptr;
+    }
+    size_t body_end = scanner.position();
+    if (!scanner.skipChar(')')) {
+        return nullptr;
+    }
+    return std::make_shared<List>(std::vector<std::shared_ptr<Element>> {
+        std::make_shared<Identifier>("func"),
+        std::make_shared<Identifier>(std::string(name)),
+        std::make_shared<List>(std::move(formal_args)),
+        std::make_shared<LazyBody>(source, body_begin, body_end, body_line),
+    });
+}
+} // namespace
+
+Program parseLazily(std::shared_ptr<std::string const> const& source)
+{
+    Tokenizer tokenizer;
+    FormScanner scanner(*source);
+    std::vector<Segment> segments {{0, 0, 0, nullptr}};
+    for (scanner.skipSpace(); !scanner.atEnd(); scanner.skipSpace()) {
+        size_t begin = scanner.position();
+        size_t line  = scanner.line();
+        if (auto definition = scanFunction(scanner, source)) {
+            segments.back().end = begin;
+            segments.push_back({begin, begin, line, std::move(definition)});
+            segments.push_back({scanner.position(), scanner.position(), scanner.line(), nullptr});
+            continue;
+        }
+        scanner.reset(begin, line);
+        if (!scanner.skipElement()) {
+            // Unbalanced, the parser reports it
+            break;
+        }
+    }
+    segments.back().end = source->size();
+
+    // All tokenizer errors go first, as in the sequential front end
+    std::vector<std::vector<Token>> tokens(segments.size());
+    for (size_t i = 0; i < segments.size(); ++i) {
+        auto const& segment = segments[i];
+        if (!segment.definition && segment.end > segment.begin) {
+            tokens[i] = tokenizer.tokenize(source->substr(segment.begin, segment.end - segment.begin), segment.first_line);
+        }
+    }
+    Program program;
+    for (size_t i = 0; i < segments.size(); ++i) {
+        if (segments[i].definition) {
+            program.push_back(std::move(segments[i].definition));
+            continue;
+        }
+        auto forms = parse(tokens[i]);
+        std::move(forms.begin(), forms.end(), std::back_inserter(program));
+    }
+    return program;
+}
+
+std::shared_ptr<Element> const& LazyBody::force() const
+{
+    std::call_once(parsed_, [this] {
+        auto program = parse(Tokenizer().tokenize(std::string(getSource()), first_line_));
+        body_        = std::move(program.front());
+    });
+    return body_;
+}
+
 } // namespace flang
@@ -0,0 +1,132 @@
+#include "flang/parse/structural_index.hpp"
+
+#include <cstdint>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+namespace flang
+{
+
+namespace
+{
+bool isSpace(char c)
+{
+    return c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\v' || c == '\f';
+}
+
+class BoundaryScanner
+{
+public:
+    explicit BoundaryScanner(std::vector<FormBoundary>& boundaries)
+        : boundaries_(boundaries)
+    {
+    }
+
+    void open()
+    {
+        ++depth_;
+    }
+
+    // false once a list is closed that was never opened
+    bool close()
+    {
+        return --depth_ >= 0;
+    }
+
+    // A form continues past the line break if a list is open or a quote
+    // mark is still waiting for its element
+    void newline(size_t offset, char last_significant)
+    {
+        ++line_;
+        if (depth_ == 0 && last_significant != '\'') {
+            boundaries_.push_back({offset + 1, line_});
+        }
+    }
+
+    bool balanced() const
+    {
+        return depth_ == 0;
+    }
+
+private:
+    std::vector<FormBoundary>& boundaries_;
+    int64_t depth_ = 0;
+    size_t line_   = 0;
+};
+} // namespace
+
+std::vector<FormBoundary> findFormBoundaries(std::string_view source)
+{
+    std::vector<FormBoundary> boundaries;
+    BoundaryScanner scanner(boundaries);
+    // Last non-whitespace character seen before the current position
+    char last_significant = '\0';
+    size_t i              = 0;
+
+#ifdef __SSE2__
+    const size_t BLOCK_SIZE = 16;
+    auto const open_paren   = _mm_set1_epi8('(');
+    auto const close_paren  = _mm_set1_epi8(')');
+    auto const newline      = _mm_set1_epi8('\n');
+    auto const space        = _mm_set1_epi8(' ');
+    // '\t' .. '\r' are the other whitespace characters
+    auto const below_tab    = _mm_set1_epi8('\t' - 1);
+    auto const above_cr     = _mm_set1_epi8('\r' + 1);
+    for (; i + BLOCK_SIZE <= source.size(); i += BLOCK_SIZE) {
+        auto block          = _mm_loadu_si128(reinterpret_cast<__m128i const*>(source.data() + i));
+        uint32_t opens      = _mm_movemask_epi8(_mm_cmpeq_epi8(block, open_paren));
+        uint32_t closes     = _mm_movemask_epi8(_mm_cmpeq_epi8(block, close_paren));
+        uint32_t newlines   = _mm_movemask_epi8(_mm_cmpeq_epi8(block, newline));
+        auto control_space  = _mm_and_si128(_mm_cmpgt_epi8(block, below_tab), _mm_cmplt_epi8(block, above_cr));
+        uint32_t spaces     = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(block, space), control_space));
+        uint32_t nonspace   = ~spaces & 0xFFFF;
+        uint32_t structural = opens | closes | newlines;
+        while (structural != 0) {
+            int bit      = __builtin_ctz(structural);
+            uint32_t pos = 1u << bit;
+            if (opens & pos) {
+                scanner.open();
+            } else if (closes & pos) {
+                if (!scanner.close()) {
+                    return {};
+                }
+            } else {
+                uint32_t before = nonspace & (pos - 1);
+                if (before != 0) {
+                    last_significant = source[i + 31 - __builtin_clz(before)];
+                }
+                scanner.newline(i + bit, last_significant);
+            }
+            structural &= structural - 1;
+        }
+        if (nonspace != 0) {
+            last_significant = source[i + 31 - __builtin_clz(nonspace)];
+        }
+    }
+#endif
+
+    for (; i < source.size(); ++i) {
+        char c = source[i];
+        if (c == '(') {
+            scanner.open();
+        } else if (c == ')') {
+            if (!scanner.close()) {
+                return {};
+            }
+        } else if (c == '\n') {
+            scanner.newline(i, last_significant);
+        }
+        if (!isSpace(c)) {
+            last_significant = c;
+        }
+    }
+
+    if (!scanner.balanced()) {
+        return {};
+    }
+    return boundaries;
+}
+
+} // namespace flang
@@ -1,13 +1,10 @@
 #include "flang/pp/ast_printer.hpp"
 #include <flang/parse/ast.hpp>
 
+#include <unordered_set>
+
 namespace flang
 {
-void AstPrinter::visitElement(std::shared_ptr<Element> node)
-{
-    node->accept(*this);
-}
-
 void AstPrinter::visitBoolean(std::shared_ptr<Boolean> node)
 {
     os_ << (node->getValue() ? "true" : "false");
@@ -35,14 +32,96 @@ void AstPrinter::visitNull(std::shared_ptr<Null> node)
 
 void AstPrinter::visitList(std::shared_ptr<List> node)
 {
-    os_ << "(";
-    for (auto it = node->getElements().begin(); it != node->getElements().end(); ++it) {
-        visitElement(*it);
-        if (it + 1 != node->getElements().end()) {
-            os_ << ' ';
+    printNested(*node);
+}
+
+// Nested lists, hash maps and arrays are walked with an explicit stack so
+// that deep data cannot overflow the native one. A hash map or an array
+// inside itself is printed as <cycle>
+void AstPrinter::printNested(Element const& root)
+{
+    struct Position {
+        Element const* container;
+        // Next element of a list or an array
+        size_t next = 0;
+        // Next entry of a hash map and the part of it: key, value or ')'
+        HashMap::Entries::const_iterator entry {};
+        int part = 0;
+    };
+    std::vector<Position> stack;
+    // Hash maps and arrays being printed, a cycle has to pass through one
+    std::unordered_set<Element const*> open;
+    auto enter = [&](Element const& container) {
+        if (isa<HashMap>(container)) {
+            if (!open.insert(&container).second) {
+                os_ << "<cycle>";
+                return;
+            }
+            os_ << "#{";
+            stack.push_back({&container, 0, static_cast<HashMap const&>(container).getEntries().begin()});
+            return;
+        }
+        if (isa<Array>(container)) {
+            if (!open.insert(&container).second) {
+                os_ << "<cycle>";
+                return;
+            }
+            os_ << "#(";
+        } else {
+            os_ << '(';
+        }
+        stack.push_back({&container});
+    };
+
+    enter(root);
+    while (!stack.empty()) {
+        auto& top                               = stack.back();
+        std::shared_ptr<Element> const* element = nullptr;
+        if (isa<HashMap>(*top.container)) {
+            auto const& entries = static_cast<HashMap const*>(top.container)->getEntries();
+            if (top.entry == entries.end()) {
+                os_ << '}';
+                open.erase(top.container);
+                stack.pop_back();
+                continue;
+            }
+            switch (top.part) {
+            case 0:
+                os_ << (top.entry == entries.begin() ? "(" : " (");
+                element  = &top.entry->first;
+                top.part = 1;
+                break;
+            case 1:
+                os_ << ' ';
+                element  = &top.entry->second;
+                top.part = 2;
+                break;
+            default:
+                os_ << ')';
+                ++top.entry;
+                top.part = 0;
+                continue;
+            }
+        } else {
+            auto const& elements = isa<List>(*top.container) ? static_cast<List const*>(top.container)->getElements()
+                                                             : static_cast<Array const*>(top.container)->getElements();
+            if (top.next == elements.size()) {
+                os_ << ')';
+                open.erase(top.container);
+                stack.pop_back();
+                continue;
+            }
+            if (top.next != 0) {
+                os_ << ' ';
+            }
+            element = &elements[top.next++];
+        }
+        if (isa<List>(**element) || isa<HashMap>(**element) || isa<Array>(**element)) {
+            enter(**element);
+        } else {
+            visitElement(*element);
         }
     }
-    os_ << ")";
 }
 
 void AstPrinter::visitUserFunction(std::shared_ptr<UserFunction> node)
@@ -55,6 +134,32 @@ void AstPrinter::visitBuiltin(std::shared_ptr<Builtin> node)
     os_ << "<built-in function " << node->getName() << ">";
 }
 
+void AstPrinter::visitHashMap(std::shared_ptr<HashMap> node)
+{
+    printNested(*node);
+}
+
+void AstPrinter::visitArray(std::shared_ptr<Array> node)
+{
+    printNested(*node);
+}
+
+void AstPrinter::visitLazyBody(std::shared_ptr<LazyBody> node)
+{
+    visitElement(node->force());
+}
+
+void AstPrinter::visitSequence(std::shared_ptr<Sequence> node)
+{
+    // Printing the elements could run forever
+    os_ << "<sequence>";
+}
+
+void AstPrinter::visitFuture(std::shared_ptr<Future> node)
+{
+    os_ << "<future>";
+}
+
 std::string printElement(std::shared_ptr<Element> const& node)
 {
     std::ostringstream oss;
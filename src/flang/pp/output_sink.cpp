@@ -0,0 +1,71 @@
+#include "flang/pp/output_sink.hpp"
+
+namespace flang
+{
+
+OutputSink::OutputSink(std::streambuf* downstream, size_t capacity)
+    : downstream_(downstream)
+    , capacity_(capacity)
+{
+}
+
+OutputSink::~OutputSink()
+{
+    flush();
+}
+
+void OutputSink::flush()
+{
+    writeBuffered();
+    downstream_->pubsync();
+}
+
+void OutputSink::writeBuffered()
+{
+    if (pptr() != pbase()) {
+        downstream_->sputn(pbase(), pptr() - pbase());
+        setp(pbase(), epptr());
+    }
+}
+
+OutputSink::int_type OutputSink::overflow(int_type ch)
+{
+    if (!buffer_ && capacity_ != 0) {
+        buffer_.reset(new char[capacity_]);
+        setp(buffer_.get(), buffer_.get() + capacity_);
+    } else {
+        writeBuffered();
+    }
+    if (traits_type::eq_int_type(ch, traits_type::eof())) {
+        return traits_type::not_eof(ch);
+    }
+    if (capacity_ == 0) {
+        return downstream_->sputc(traits_type::to_char_type(ch));
+    }
+    *pptr() = traits_type::to_char_type(ch);
+    pbump(1);
+    return ch;
+}
+
+std::streamsize OutputSink::xsputn(char const* s, std::streamsize n)
+{
+    // Chunks that would not fit go straight through
+    if (static_cast<size_t>(n) > capacity_ / 2) {
+        writeBuffered();
+        return downstream_->sputn(s, n);
+    }
+    if (epptr() - pptr() < n) {
+        overflow(traits_type::eof());
+    }
+    traits_type::copy(pptr(), s, n);
+    pbump(static_cast<int>(n));
+    return n;
+}
+
+int OutputSink::sync()
+{
+    flush();
+    return 0;
+}
+
+} // namespace flang
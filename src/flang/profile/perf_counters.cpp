@@ -0,0 +1,186 @@
+#include "flang/profile/perf_counters.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <iomanip>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#endif
+
+namespace flang
+{
+
+namespace
+{
+const size_t MAX_REPORTED_FORMS = 20;
+
+char const* const EVENT_NAMES[N_PERF_EVENTS] = {"cycles", "instructions", "cache-misses", "branch-misses"};
+
+// -1 and errno set if the event can't be counted
+int openCounter([[maybe_unused]] PerfEvent event)
+{
+#ifdef __linux__
+    const uint64_t CONFIGS[N_PERF_EVENTS] = {PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS, PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES};
+    perf_event_attr attr {};
+    attr.size           = sizeof(attr);
+    attr.type           = PERF_TYPE_HARDWARE;
+    attr.config         = CONFIGS[static_cast<size_t>(event)];
+    attr.exclude_kernel = 1;
+    attr.exclude_hv     = 1;
+    // Worker threads started later are counted once they exit
+    attr.inherit     = 1;
+    attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    return static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, -1, PERF_FLAG_FD_CLOEXEC));
+#else
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+} // namespace
+
+PerfSample& PerfSample::operator+=(PerfSample const& other)
+{
+    time += other.time;
+    for (size_t i = 0; i < N_PERF_EVENTS; ++i) {
+        events[i] += other.events[i];
+    }
+    return *this;
+}
+
+PerfSample PerfSample::operator-(PerfSample const& other) const
+{
+    PerfSample result;
+    result.time = time - other.time;
+    for (size_t i = 0; i < N_PERF_EVENTS; ++i) {
+        result.events[i] = events[i] - other.events[i];
+    }
+    return result;
+}
+
+PerfCounters::PerfCounters(bool per_form)
+    : per_form_(per_form)
+    , owner_(std::this_thread::get_id())
+{
+    for (size_t i = 0; i < N_PERF_EVENTS; ++i) {
+        fds_[i] = openCounter(static_cast<PerfEvent>(i));
+        if (fds_[i] < 0 && error_.empty()) {
+            error_ = std::string("perf_event_open: ") + std::strerror(errno);
+        }
+    }
+    active_ = this;
+}
+
+PerfCounters::~PerfCounters()
+{
+    if (active_ == this) {
+        active_ = nullptr;
+    }
+    for (int fd : fds_) {
+        if (fd >= 0) {
+            close(fd);
+        }
+    }
+}
+
+bool PerfCounters::available(PerfEvent event) const
+{
+    return fds_[static_cast<size_t>(event)] >= 0;
+}
+
+bool PerfCounters::counts(char const* category) const
+{
+    return std::this_thread::get_id() == owner_ && (per_form_ || std::strcmp(category, "form") != 0);
+}
+
+PerfSample PerfCounters::read() const
+{
+    PerfSample sample;
+    sample.time = std::chrono::steady_clock::now().time_since_epoch();
+    for (size_t i = 0; i < N_PERF_EVENTS; ++i) {
+        // value, time enabled, time running
+        uint64_t values[3] = {};
+        if (fds_[i] < 0 || ::read(fds_[i], values, sizeof(values)) != sizeof(values)) {
+            continue;
+        }
+        // Scaled up if the counter had to share the PMU with others
+        sample.events[i] = values[2] == 0 || values[1] == values[2] ? values[0] : static_cast<uint64_t>(static_cast<double>(values[0]) * values[1] / values[2]);
+    }
+    return sample;
+}
+
+void PerfCounters::record(char const* category, std::string name, PerfSample const& sample)
+{
+    if (std::strcmp(category, "form") == 0) {
+        forms_.push_back({std::move(name), sample});
+        return;
+    }
+    auto it = std::find_if(phases_.begin(), phases_.end(), [&name](Entry const& entry) { return entry.name == name; });
+    if (it == phases_.end()) {
+        phases_.push_back({std::move(name), sample});
+    } else {
+        it->sample += sample;
+    }
+}
+
+void PerfCounters::write(std::ostream& os) const
+{
+    bool ipc = available(PerfEvent::Cycles) && available(PerfEvent::Instructions);
+    auto header = [&] {
+        os << "  " << std::right << std::setw(10) << "ms";
+        for (size_t i = 0; i < N_PERF_EVENTS; ++i) {
+            if (available(static_cast<PerfEvent>(i))) {
+                os << std::setw(15) << EVENT_NAMES[i];
+            }
+        }
+        os << (ipc ? "    IPC" : "") << "\n";
+    };
+    auto row = [&](Entry const& entry) {
+        auto const& events = entry.sample.events;
+        os << "  " << std::right << std::fixed << std::setprecision(3) << std::setw(10) << std::chrono::duration<double, std::milli>(entry.sample.time).count();
+        for (size_t i = 0; i < N_PERF_EVENTS; ++i) {
+            if (available(static_cast<PerfEvent>(i))) {
+                os << std::setw(15) << events[i];
+            }
+        }
+        if (ipc) {
+            auto cycles = events[static_cast<size_t>(PerfEvent::Cycles)];
+            os << std::setprecision(2) << std::setw(7) << (cycles == 0 ? 0.0 : static_cast<double>(events[static_cast<size_t>(PerfEvent::Instructions)]) / cycles);
+        }
+        os << "  " << entry.name << "\n";
+        os << std::defaultfloat;
+    };
+
+    os << "----- flang perf counters -----\n";
+    if (!error_.empty()) {
+        bool none = std::none_of(fds_.begin(), fds_.end(), [](int fd) { return fd >= 0; });
+        os << (none ? "(hardware counters unavailable, " : "(some hardware counters unavailable, ") << error_ << ")\n";
+    }
+    os << "phases:\n";
+    header();
+    for (auto const& phase : phases_) {
+        row(phase);
+    }
+    if (!per_form_) {
+        return;
+    }
+
+    // The most expensive forms, by cycles if those are counted
+    auto forms   = forms_;
+    auto cycles  = static_cast<size_t>(PerfEvent::Cycles);
+    bool by_time = !available(PerfEvent::Cycles);
+    std::stable_sort(forms.begin(), forms.end(), [&](Entry const& lhs, Entry const& rhs) {
+        return by_time ? lhs.sample.time > rhs.sample.time : lhs.sample.events[cycles] > rhs.sample.events[cycles];
+    });
+    forms.resize(std::min(forms.size(), MAX_REPORTED_FORMS));
+    os << "top-level forms by " << (by_time ? "time" : "cycles") << ":\n";
+    header();
+    for (auto const& form : forms) {
+        row(form);
+    }
+}
+
+} // namespace flang
@@ -0,0 +1,151 @@
+#include "flang/profile/sample_profiler.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <map>
+#include <mutex>
+#include <signal.h>
+#include <stdexcept>
+#include <sys/time.h>
+#include <vector>
+
+namespace flang
+{
+
+namespace
+{
+const size_t RING_CAPACITY      = 4096;
+const size_t MAX_SAMPLED_DEPTH  = 128;
+const FrameId TRUNCATED_FRAME   = static_cast<FrameId>(-1);
+
+struct Sample {
+    std::atomic<bool> ready;
+    uint32_t depth;
+    FrameId frames[MAX_SAMPLED_DEPTH];
+};
+
+Sample ring[RING_CAPACITY];
+std::atomic<uint64_t> ring_write {0};
+std::atomic<uint64_t> ring_read {0};
+std::atomic<uint64_t> dropped {0};
+
+// Guards the reading end of the ring and the aggregate
+std::mutex drain_mutex;
+std::map<std::vector<FrameId>, uint64_t> folded;
+struct sigaction previous_action;
+} // namespace
+
+static_assert(std::atomic<uint64_t>::is_always_lock_free, "ring buffer indices must be usable from a signal handler");
+
+void SampleProfiler::onSignal(int)
+{
+    auto* stack = ShadowStack::current();
+    if (stack == nullptr) {
+        return;
+    }
+    auto write = ring_write.load(std::memory_order_relaxed);
+    auto used  = write - ring_read.load(std::memory_order_acquire);
+    if (used >= RING_CAPACITY || !ring_write.compare_exchange_strong(write, write + 1, std::memory_order_acq_rel)) {
+        dropped.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    if (used + 1 >= RING_CAPACITY / 2) {
+        drain_requested_.store(true, std::memory_order_relaxed);
+    }
+
+    auto& sample  = ring[write % RING_CAPACITY];
+    size_t depth  = std::min(stack->depth(), SHADOW_STACK_CAPACITY);
+    size_t first  = depth > MAX_SAMPLED_DEPTH ? depth - MAX_SAMPLED_DEPTH + 1 : 0;
+    size_t n      = 0;
+    if (first > 0) {
+        sample.frames[n++] = TRUNCATED_FRAME;
+    }
+    for (size_t i = first; i < depth; ++i) {
+        sample.frames[n++] = stack->frames()[i];
+    }
+    sample.depth = static_cast<uint32_t>(n);
+    sample.ready.store(true, std::memory_order_release);
+}
+
+void SampleProfiler::start(int hz)
+{
+    if (hz <= 0 || hz > MAX_HZ) {
+        throw std::invalid_argument("Sampling frequency must be in range 1..1000000 Hz");
+    }
+    struct sigaction action {};
+    action.sa_handler = onSignal;
+    action.sa_flags   = SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    if (sigaction(SIGPROF, &action, &previous_action) != 0) {
+        throw std::runtime_error(std::string("sigaction: ") + std::strerror(errno));
+    }
+
+    // tv_usec must stay below a second
+    struct itimerval timer {};
+    timer.it_interval.tv_sec  = 1 / hz;
+    timer.it_interval.tv_usec = (1000000 / hz) % 1000000;
+    timer.it_value            = timer.it_interval;
+    if (setitimer(ITIMER_PROF, &timer, nullptr) != 0) {
+        auto error = std::string("setitimer: ") + std::strerror(errno);
+        sigaction(SIGPROF, &previous_action, nullptr);
+        throw std::runtime_error(error);
+    }
+}
+
+void SampleProfiler::stop()
+{
+    struct itimerval timer {};
+    setitimer(ITIMER_PROF, &timer, nullptr);
+    sigaction(SIGPROF, &previous_action, nullptr);
+    drain();
+}
+
+void SampleProfiler::drain()
+{
+    std::lock_guard lock(drain_mutex);
+    drainLocked();
+}
+
+void SampleProfiler::tryDrain()
+{
+    std::unique_lock lock(drain_mutex, std::try_to_lock);
+    if (lock.owns_lock()) {
+        drainLocked();
+    }
+}
+
+void SampleProfiler::drainLocked()
+{
+    drain_requested_.store(false, std::memory_order_relaxed);
+    auto read = ring_read.load(std::memory_order_relaxed);
+    while (read < ring_write.load(std::memory_order_acquire)) {
+        auto& sample = ring[read % RING_CAPACITY];
+        if (!sample.ready.load(std::memory_order_acquire)) {
+            // The handler claimed the slot but has not filled it yet
+            break;
+        }
+        folded[std::vector<FrameId>(sample.frames, sample.frames + sample.depth)]++;
+        sample.ready.store(false, std::memory_order_relaxed);
+        ring_read.store(++read, std::memory_order_release);
+    }
+}
+
+uint64_t SampleProfiler::droppedSamples()
+{
+    return dropped.load(std::memory_order_relaxed);
+}
+
+void SampleProfiler::writeFoldedStacks(std::ostream& os)
+{
+    std::lock_guard lock(drain_mutex);
+    for (auto const& [frames, count] : folded) {
+        os << "<toplevel>";
+        for (auto frame : frames) {
+            os << ';' << (frame == TRUNCATED_FRAME ? "[truncated]" : frameName(frame));
+        }
+        os << ' ' << count << '\n';
+    }
+}
+
+} // namespace flang
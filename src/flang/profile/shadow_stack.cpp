@@ -0,0 +1,52 @@
+#include "flang/profile/shadow_stack.hpp"
+
+#include <deque>
+#include <mutex>
+#include <unordered_map>
+
+namespace flang
+{
+
+namespace
+{
+std::mutex frame_names_mutex;
+std::unordered_map<std::string, FrameId> frame_ids;
+// Index 0 is reserved for NO_FRAME
+std::deque<std::string> frame_names = {"<none>"};
+
+thread_local ShadowStack* current_shadow_stack = nullptr;
+} // namespace
+
+FrameId internFrameName(std::string const& name)
+{
+    std::lock_guard lock(frame_names_mutex);
+    auto [it, inserted] = frame_ids.try_emplace(name, static_cast<FrameId>(frame_names.size()));
+    if (inserted) {
+        frame_names.push_back(name);
+    }
+    return it->second;
+}
+
+std::string const& frameName(FrameId id)
+{
+    std::lock_guard lock(frame_names_mutex);
+    return frame_names.at(id);
+}
+
+ShadowStack* ShadowStack::current()
+{
+    return current_shadow_stack;
+}
+
+ShadowStack::Activation::Activation(ShadowStack* stack)
+    : previous_(current_shadow_stack)
+{
+    current_shadow_stack = stack;
+}
+
+ShadowStack::Activation::~Activation()
+{
+    current_shadow_stack = previous_;
+}
+
+} // namespace flang
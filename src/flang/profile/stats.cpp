@@ -0,0 +1,187 @@
+#include "flang/profile/stats.hpp"
+#include "flang/eval/runtime_heap.hpp"
+
+#include <algorithm>
+#include <iomanip>
+#include <mutex>
+#include <sys/resource.h>
+
+namespace flang
+{
+
+namespace
+{
+void printPhase(std::ostream& os, char const* name, std::chrono::nanoseconds time)
+{
+    os << "  " << std::left << std::setw(12) << name << std::chrono::duration<double, std::milli>(time).count() << " ms\n";
+}
+
+void printCounter(std::ostream& os, std::string const& name, uint64_t value)
+{
+    os << "  " << std::left << std::setw(20) << name << value << "\n";
+}
+
+void addCounts(std::vector<uint64_t>& to, std::vector<uint64_t> const& from)
+{
+    if (to.size() < from.size()) {
+        to.resize(from.size());
+    }
+    for (size_t i = 0; i < from.size(); ++i) {
+        to[i] += from[i];
+    }
+}
+
+// Function-local, AST nodes may be created during static initialization
+std::mutex& exitedMutex()
+{
+    static std::mutex mutex;
+    return mutex;
+}
+
+Statistics& exitedStatistics()
+{
+    static Statistics statistics;
+    return statistics;
+}
+
+struct ThreadStatistics {
+    Statistics statistics;
+
+    ThreadStatistics()
+    {
+        // Constructed before this one, so still there when it is destroyed
+        exitedMutex();
+        exitedStatistics();
+    }
+    ~ThreadStatistics()
+    {
+        std::lock_guard lock(exitedMutex());
+        exitedStatistics().merge(statistics);
+    }
+};
+} // namespace
+
+void Statistics::merge(Statistics const& other)
+{
+    tokenize_time += other.tokenize_time;
+    parse_time += other.parse_time;
+    eval_time += other.eval_time;
+    for (size_t kind = 0; kind < N_ELEMENT_KINDS; ++kind) {
+        allocations[kind] += other.allocations[kind];
+    }
+    addCounts(lookup_depth, other.lookup_depth);
+    lookup_misses += other.lookup_misses;
+    peak_environment_depth = std::max(peak_environment_depth, other.peak_environment_depth);
+    addCounts(builtin_calls, other.builtin_calls);
+    quickened_calls += other.quickened_calls;
+    call_site_deopts += other.call_site_deopts;
+    eval_cache_hits += other.eval_cache_hits;
+    eval_cache_misses += other.eval_cache_misses;
+    eval_cache_evictions += other.eval_cache_evictions;
+    returns_thrown += other.returns_thrown;
+    breaks_thrown += other.breaks_thrown;
+}
+
+Statistics& statistics()
+{
+    thread_local ThreadStatistics thread_statistics;
+    return thread_statistics.statistics;
+}
+
+Statistics collectStatistics()
+{
+    std::lock_guard lock(exitedMutex());
+    auto result = exitedStatistics();
+    result.merge(statistics());
+    return result;
+}
+
+void resetStatistics()
+{
+    std::lock_guard lock(exitedMutex());
+    exitedStatistics() = Statistics();
+    statistics()       = Statistics();
+}
+
+bool statisticsEnabled()
+{
+#ifdef FLANG_ENABLE_STATS
+    return true;
+#else
+    return false;
+#endif
+}
+
+long peakRssKb()
+{
+    struct rusage usage {};
+    if (getrusage(RUSAGE_SELF, &usage) != 0) {
+        return -1;
+    }
+    return usage.ru_maxrss;
+}
+
+void printStatistics(std::ostream& os)
+{
+    auto stats = collectStatistics();
+    os << "----- flang statistics -----\n";
+    os << "phases:\n";
+    printPhase(os, "tokenize", stats.tokenize_time);
+    printPhase(os, "parse", stats.parse_time);
+    printPhase(os, "eval", stats.eval_time);
+    os << "peak RSS: " << peakRssKb() << " KiB\n";
+    auto heap = heapStatistics();
+    os << "runtime heap reserved: " << heap.reserved_bytes / 1024 << " KiB\n";
+    os << "garbage collector:\n";
+    printCounter(os, "tracked containers", heap.tracked_containers);
+    printCounter(os, "collections", heap.collections);
+    printCounter(os, "freed containers", heap.collected_containers);
+    printPhase(os, "total pause", std::chrono::nanoseconds(heap.total_pause_ns));
+    printPhase(os, "max pause", std::chrono::nanoseconds(heap.max_pause_ns));
+
+    if (!statisticsEnabled()) {
+        os << "(runtime counters are disabled, rebuild with -DENABLE_STATS=ON)\n";
+        return;
+    }
+
+    os << "element allocations:\n";
+    for (size_t kind = 0; kind < N_ELEMENT_KINDS; ++kind) {
+        printCounter(os, kindName(static_cast<ElementKind>(kind)), stats.allocations[kind]);
+    }
+
+    os << "runtime heap:\n";
+    printCounter(os, "allocations", heap.allocations);
+    printCounter(os, "live bytes", heap.live_bytes);
+    printCounter(os, "peak live bytes", heap.peak_live_bytes);
+
+    os << "loadVariable frames walked before hit:\n";
+    for (size_t frames = 0; frames < stats.lookup_depth.size(); ++frames) {
+        if (stats.lookup_depth[frames] != 0) {
+            printCounter(os, std::to_string(frames), stats.lookup_depth[frames]);
+        }
+    }
+    printCounter(os, "miss", stats.lookup_misses);
+    os << "peak environment depth: " << stats.peak_environment_depth << "\n";
+
+    os << "builtin calls:\n";
+    for (FrameId id = 0; id < stats.builtin_calls.size(); ++id) {
+        if (stats.builtin_calls[id] != 0) {
+            printCounter(os, frameName(id), stats.builtin_calls[id]);
+        }
+    }
+
+    os << "call sites:\n";
+    printCounter(os, "quickened calls", stats.quickened_calls);
+    printCounter(os, "deoptimized", stats.call_site_deopts);
+
+    os << "eval cache:\n";
+    printCounter(os, "hits", stats.eval_cache_hits);
+    printCounter(os, "misses", stats.eval_cache_misses);
+    printCounter(os, "evictions", stats.eval_cache_evictions);
+
+    os << "control flow exceptions:\n";
+    printCounter(os, "flang_return", stats.returns_thrown);
+    printCounter(os, "flang_break", stats.breaks_thrown);
+}
+
+} // namespace flang
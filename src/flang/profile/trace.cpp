@@ -0,0 +1,101 @@
+#include "flang/profile/trace.hpp"
+
+#include <atomic>
+#include <iomanip>
+
+namespace flang
+{
+
+namespace
+{
+uint32_t currentThreadId()
+{
+    static std::atomic<uint32_t> next_id {1};
+    thread_local uint32_t id = next_id.fetch_add(1);
+    return id;
+}
+
+void writeJsonString(std::ostream& os, std::string const& value)
+{
+    os << '"';
+    for (char c : value) {
+        switch (c) {
+            case '"':
+                os << "\\\"";
+                break;
+            case '\\':
+                os << "\\\\";
+                break;
+            case '\n':
+                os << "\\n";
+                break;
+            case '\t':
+                os << "\\t";
+                break;
+            default:
+                if (static_cast<unsigned char>(c) < 0x20) {
+                    os << "\\u" << std::hex << std::setw(4) << std::setfill('0') << int(c) << std::dec << std::setfill(' ');
+                } else {
+                    os << c;
+                }
+        }
+    }
+    os << '"';
+}
+} // namespace
+
+TraceRecorder::TraceRecorder(std::chrono::microseconds call_threshold)
+    : origin_(clock::now())
+    , call_threshold_(call_threshold)
+{
+    active_ = this;
+}
+
+TraceRecorder::~TraceRecorder()
+{
+    if (active_ == this) {
+        active_ = nullptr;
+    }
+}
+
+void TraceRecorder::record(std::string category, std::string name, clock::time_point start, clock::time_point end)
+{
+    push({std::move(category), std::move(name), NO_FRAME, sinceOrigin(start), sinceOrigin(end) - sinceOrigin(start), currentThreadId()});
+}
+
+void TraceRecorder::recordCall(FrameId frame, clock::time_point start, clock::time_point end)
+{
+    if (end - start < call_threshold_) {
+        return;
+    }
+    push({"call", "", frame, sinceOrigin(start), sinceOrigin(end) - sinceOrigin(start), currentThreadId()});
+}
+
+void TraceRecorder::push(Event event)
+{
+    std::lock_guard lock(mutex_);
+    events_.push_back(std::move(event));
+}
+
+double TraceRecorder::sinceOrigin(clock::time_point point) const
+{
+    return std::chrono::duration<double, std::micro>(point - origin_).count();
+}
+
+void TraceRecorder::write(std::ostream& os) const
+{
+    std::lock_guard lock(mutex_);
+    os << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+    os << std::fixed << std::setprecision(3);
+    for (size_t i = 0; i < events_.size(); ++i) {
+        auto const& event = events_[i];
+        os << (i == 0 ? "\n" : ",\n") << "{\"name\":";
+        writeJsonString(os, event.frame == NO_FRAME ? event.name : frameName(event.frame));
+        os << ",\"cat\":";
+        writeJsonString(os, event.category);
+        os << ",\"ph\":\"X\",\"ts\":" << event.ts_us << ",\"dur\":" << event.dur_us << ",\"pid\":1,\"tid\":" << event.tid << "}";
+    }
+    os << "\n]}\n";
+}
+
+} // namespace flang
@@ -4,13 +4,13 @@
 
 namespace flang
 {
-std::vector<Token> Tokenizer::tokenize(std::string const& source) const
+std::vector<Token> Tokenizer::tokenize(std::string const& source, size_t first_line) const
 {
     std::vector<Token> tokenized_source;
 
     std::istringstream source_stream(source);
     std::string line;
-    size_t line_number = 0;
+    size_t line_number = first_line;
 
     while (std::getline(source_stream, line)) {
         auto from_it = line.cbegin();
@@ -1,14 +1,151 @@
+#include <flang/eval/future.hpp>
+#include <flang/eval/incremental.hpp>
+#include <flang/eval/jit.hpp>
+#include <flang/eval/scheduler.hpp>
 #include <flang/parse/ast.hpp>
 #include <flang/parse/parser.hpp>
+#include <flang/profile/perf_counters.hpp>
+#include <flang/profile/sample_profiler.hpp>
+#include <flang/profile/stats.hpp>
+#include <flang/profile/trace.hpp>
+#include <charconv>
+#include <filesystem>
 #include <fstream>
 #include <iostream>
 #include <iterator>
+#include <limits>
+#include <memory>
+#include <optional>
+#include <sstream>
+#include <thread>
+#include <utility>
 
 #include "flang/eval/eval_visitor.hpp"
 #include "flang/flang_exception.hpp"
 #include "flang/tokenize/tokenizer.hpp"
 
 
+struct Options {
+    // More than one file runs them side by side on the scheduler
+    std::vector<std::string> source_file_names;
+    std::optional<int> sample_profile_hz;
+    bool stats = false;
+    std::optional<std::string> trace_file_name;
+    std::chrono::microseconds trace_threshold {100};
+    size_t output_buffer_size = flang::DEFAULT_OUTPUT_BUFFER_SIZE;
+    bool jit                  = false;
+    bool lazy_parse           = false;
+    bool watch                = false;
+    // Hardware counters per phase, with --perf=forms also per top-level form
+    bool perf                 = false;
+    bool perf_forms           = false;
+    size_t threads            = std::thread::hardware_concurrency();
+    size_t fuel               = flang::DEFAULT_SCRIPT_FUEL;
+    // --data=NAME=PATH, files for loadsexp/loadcsv
+    std::vector<std::pair<std::string, std::string>> data_files;
+};
+
+void printUsage()
+{
+    std::cout << "Usage: ./main [--sample-profile=HZ] [--stats] [--trace=out.json [--trace-threshold-us=N]] [--output-buffer=BYTES] [--jit] [--lazy-parse] [--threads=N] [--fuel=N] [--data=NAME=PATH]... [--watch] [--perf[=forms]] <source_file>...";
+}
+
+// The number after `prefix` in `arg`, or std::nullopt after a message if
+// it is not one in min..max
+template <class T>
+std::optional<T> parseNumber(std::string const& arg, std::string const& prefix, T min = std::numeric_limits<T>::min(),
+                             T max = std::numeric_limits<T>::max())
+{
+    char const* begin = arg.data() + prefix.size();
+    char const* end   = arg.data() + arg.size();
+    T value {};
+    auto [value_end, error] = std::from_chars(begin, end, value);
+    if (error != std::errc() || value_end != end || value < min || value > max) {
+        std::cerr << "invalid value for " << prefix.substr(0, prefix.size() - 1) << "\n";
+        return std::nullopt;
+    }
+    return value;
+}
+
+std::optional<Options> parseOptions(int argc, char* argv[])
+{
+    Options options;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg.starts_with("--sample-profile=")) {
+            options.sample_profile_hz = parseNumber(arg, "--sample-profile=", 1, flang::SampleProfiler::MAX_HZ);
+            if (!options.sample_profile_hz) {
+                return std::nullopt;
+            }
+        } else if (arg.starts_with("--trace=")) {
+            options.trace_file_name = arg.substr(std::string("--trace=").size());
+        } else if (arg.starts_with("--trace-threshold-us=")) {
+            auto threshold = parseNumber<int64_t>(arg, "--trace-threshold-us=", 0);
+            if (!threshold) {
+                return std::nullopt;
+            }
+            options.trace_threshold = std::chrono::microseconds(*threshold);
+        } else if (arg.starts_with("--output-buffer=")) {
+            auto size = parseNumber<size_t>(arg, "--output-buffer=");
+            if (!size) {
+                return std::nullopt;
+            }
+            options.output_buffer_size = *size;
+        } else if (arg.starts_with("--threads=")) {
+            auto threads = parseNumber<size_t>(arg, "--threads=");
+            if (!threads) {
+                return std::nullopt;
+            }
+            options.threads = *threads;
+        } else if (arg.starts_with("--fuel=")) {
+            auto fuel = parseNumber<size_t>(arg, "--fuel=");
+            if (!fuel) {
+                return std::nullopt;
+            }
+            options.fuel = *fuel;
+        } else if (arg.starts_with("--data=")) {
+            auto binding   = arg.substr(std::string("--data=").size());
+            auto separator = binding.find('=');
+            if (separator == std::string::npos) {
+                std::cerr << "Expected --data=NAME=PATH\n";
+                return std::nullopt;
+            }
+            options.data_files.emplace_back(binding.substr(0, separator), binding.substr(separator + 1));
+        } else if (arg == "--stats") {
+            options.stats = true;
+        } else if (arg == "--jit") {
+            options.jit = true;
+        } else if (arg == "--lazy-parse") {
+            options.lazy_parse = true;
+        } else if (arg == "--perf" || arg == "--perf=forms") {
+            options.perf       = true;
+            options.perf_forms = arg == "--perf=forms";
+        } else if (arg == "--watch") {
+            options.watch = true;
+        } else if (arg.starts_with("--")) {
+            std::cerr << "Unknown option " << arg << "\n";
+            return std::nullopt;
+        } else {
+            options.source_file_names.push_back(arg);
+        }
+    }
+    if (options.source_file_names.empty()) {
+        return std::nullopt;
+    }
+    if (options.watch && options.source_file_names.size() > 1) {
+        std::cerr << "--watch takes a single source file\n";
+        return std::nullopt;
+    }
+    return options;
+}
+
+// Data files not given with --data are looked up next to the script
+std::string dataDirectory(std::string const& source_file_name)
+{
+    auto directory = std::filesystem::path(source_file_name).parent_path();
+    return directory.empty() ? "." : directory.string();
+}
+
 std::string readSource(std::string const& source_file_name)
 {
     std::ifstream input(source_file_name);
@@ -18,21 +155,186 @@ std::string readSource(std::string const& source_file_name)
     return {std::istreambuf_iterator<char>(input), std::istreambuf_iterator<char>()};
 }
 
+flang::Program parseProgram(std::string source, Options const& options)
+{
+    auto& stats = flang::statistics();
+    if (options.lazy_parse) {
+        // Function bodies keep pointing into the source until they are called
+        flang::PhaseTimer timer(stats.parse_time);
+        flang::TraceSpan span("phase", "parse");
+        flang::PerfSpan counters("phase", "parse");
+        return flang::parseLazily(std::make_shared<std::string const>(std::move(source)));
+    }
+    if (source.size() >= flang::PARALLEL_PARSE_MIN_SIZE) {
+        // Chunks are tokenized and parsed in one go on several threads
+        flang::PhaseTimer timer(stats.parse_time);
+        flang::TraceSpan span("phase", "parse");
+        flang::PerfSpan counters("phase", "parse");
+        return flang::parseSource(source);
+    }
+    std::vector<flang::Token> tokens;
+    {
+        flang::PhaseTimer timer(stats.tokenize_time);
+        flang::TraceSpan span("phase", "tokenize");
+        flang::PerfSpan counters("phase", "tokenize");
+        tokens = flang::Tokenizer().tokenize(source);
+    }
+    flang::PhaseTimer timer(stats.parse_time);
+    flang::TraceSpan span("phase", "parse");
+    flang::PerfSpan counters("phase", "parse");
+    return flang::parse(tokens);
+}
+
+// Runs all source files side by side, the output of each one is printed
+// in order once all of them have finished
+int runScripts(Options const& options)
+{
+    flang::Scheduler scheduler(options.threads, options.fuel);
+    if (options.jit) {
+        scheduler.enableJit();
+    }
+    for (auto const& [name, path] : options.data_files) {
+        scheduler.addDataFile(name, path);
+    }
+    std::vector<std::unique_ptr<std::stringbuf>> outputs;
+    for (auto const& file_name : options.source_file_names) {
+        outputs.push_back(std::make_unique<std::stringbuf>());
+        scheduler.submit(file_name, parseProgram(readSource(file_name), options), outputs.back().get(), dataDirectory(file_name));
+    }
+    std::vector<flang::ScriptReport> reports;
+    {
+        flang::PhaseTimer timer(flang::statistics().eval_time);
+        flang::TraceSpan span("phase", "eval");
+        flang::PerfSpan counters("phase", "eval");
+        reports = scheduler.run();
+    }
+    int exit_code = 0;
+    for (size_t i = 0; i < reports.size(); ++i) {
+        std::cout << outputs[i]->str();
+        if (!reports[i].error.empty()) {
+            std::cerr << "\nERROR in " << reports[i].name << ": " << reports[i].error;
+            exit_code = 1;
+        }
+    }
+    if (options.stats) {
+        flang::printScriptReports(std::cerr, reports);
+    }
+    return exit_code;
+}
+
+void setUpVisitor(flang::EvalVisitor& visitor, Options const& options)
+{
+    if (options.jit) {
+        if (!flang::jitSupported()) {
+            std::cerr << "--jit is not supported on this platform, interpreting\n";
+        }
+        visitor.enableJit();
+    }
+    for (auto const& [name, path] : options.data_files) {
+        visitor.addDataFile(name, path);
+    }
+    visitor.setDataDirectory(dataDirectory(options.source_file_names.front()));
+}
+
+const auto WATCH_POLL_INTERVAL = std::chrono::milliseconds(100);
+
+// Evaluates the script, then polls it for changes and evaluates the forms
+// affected by each edit, see incremental.hpp. Runs until interrupted
+void watchScript(Options options)
+{
+    auto const& source_file_name = options.source_file_names.front();
+    // Lazily parsed bodies don't hash by content, so every edit would look like a change everywhere
+    options.lazy_parse = false;
+    flang::EvalVisitor visitor(options.output_buffer_size);
+    setUpVisitor(visitor, options);
+    flang::IncrementalProgram program(visitor);
+    std::optional<std::filesystem::file_time_type> last_write_time;
+    while (true) {
+        std::error_code error;
+        auto write_time = std::filesystem::last_write_time(source_file_name, error);
+        if (!error && write_time != last_write_time) {
+            last_write_time = write_time;
+            auto start      = std::chrono::steady_clock::now();
+            try {
+                auto report = program.update(parseProgram(readSource(source_file_name), options));
+                visitor.output().flush();
+                auto elapsed = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start);
+                std::cerr << "\n[watch] evaluated " << report.evaluated << " of " << report.forms << " forms in " << elapsed.count() << " ms\n";
+            } catch (flang::flang_exception const& e) {
+                visitor.output().flush();
+                std::cerr << "\nERROR: " << e.what() << "\n";
+            } catch (std::runtime_error const& e) {
+                std::cerr << "\nERROR: " << e.what() << "\n";
+            }
+        }
+        std::this_thread::sleep_for(WATCH_POLL_INTERVAL);
+    }
+}
+
 int main(int argc, char* argv[])
 {
-    if (argc < 2) {
-        std::cout << "Usage: ./main <source_file>";
+    auto options = parseOptions(argc, argv);
+    if (!options) {
+        printUsage();
         return 1;
     }
-    std::string source_file_name = argv[1];
-    std::string source           = readSource(source_file_name);
+    if (options->sample_profile_hz) {
+        try {
+            flang::SampleProfiler::start(*options->sample_profile_hz);
+        } catch (std::runtime_error const& e) {
+            std::cerr << "ERROR: " << e.what() << "\n";
+            return 1;
+        }
+    }
+    // Also the threads evaluating futures, started by the first one
+    flang::FuturePool::instance().setThreads(options->threads);
+    std::optional<flang::TraceRecorder> trace;
+    if (options->trace_file_name) {
+        trace.emplace(options->trace_threshold);
+    }
+    std::optional<flang::PerfCounters> perf;
+    if (options->perf) {
+        perf.emplace(options->perf_forms);
+    }
+    int exit_code = 0;
     try {
-        auto tokens = flang::Tokenizer().tokenize(source);
-        auto prog   = flang::parse(tokens);
-        flang::EvalVisitor().visitProgram(prog);
+        if (options->watch) {
+            watchScript(*options);
+        } else if (options->source_file_names.size() > 1) {
+            exit_code = runScripts(*options);
+        } else {
+            auto const& source_file_name = options->source_file_names.front();
+            auto prog                    = parseProgram(readSource(source_file_name), *options);
+            flang::PhaseTimer timer(flang::statistics().eval_time);
+            flang::TraceSpan span("phase", "eval");
+            flang::PerfSpan counters("phase", "eval");
+            // Output is flushed when the visitor goes away, also when unwinding an error
+            flang::EvalVisitor visitor(options->output_buffer_size);
+            setUpVisitor(visitor, *options);
+            visitor.visitProgram(prog);
+        }
     } catch (flang::flang_exception const& e) {
         std::cerr << "\nERROR: " << e.what();
-        return 1;
+        exit_code = 1;
+    }
+    // Untouched futures may still run, and they use statics that are
+    // destroyed before the pool
+    flang::FuturePool::instance().shutdown();
+    if (options->sample_profile_hz) {
+        flang::SampleProfiler::stop();
+        flang::SampleProfiler::writeFoldedStacks(std::cerr);
+    }
+    if (trace) {
+        std::ofstream trace_output(*options->trace_file_name);
+        trace->write(trace_output);
+    }
+    if (options->stats) {
+        std::cout.flush();
+        flang::printStatistics(std::cerr);
+    }
+    if (perf) {
+        std::cout.flush();
+        perf->write(std::cerr);
     }
-    return 0;
+    return exit_code;
 }
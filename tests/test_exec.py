@@ -1,4 +1,5 @@
 import os
+import resource
 from pathlib import Path
 import subprocess
 from typing import Iterable, Sequence, Tuple
@@ -61,20 +62,94 @@ def run_binary(args: Sequence[str]) -> subprocess.CompletedProcess[str]:
     )
 
 
-def execute_compiled_binary(test_id: str, input: Path) -> None:
-    result = run_binary([str(get_compiler_binary()), str(input)])
+def execute_compiled_binary(test_id: str, input: Path, flags: Sequence[str] = ()) -> None:
+    result = run_binary([str(get_compiler_binary()), *flags, str(input)])
     if result.returncode != 0:
         pytest.fail(
             f"[Execution Error] {test_id}\n\n----- CAPTURED OUTPUT -----\n{result.stdout}"
         )
 
 
-def run_test(test_file: Path) -> None:
+def run_test(test_file: Path, flags: Sequence[str] = ()) -> None:
     maybe_skip_test(test_file)
-    test_id = get_test_id(test_file)
-    execute_compiled_binary(get_test_id(test_file), test_file)
+    execute_compiled_binary(get_test_id(test_file), test_file, flags)
 
 
+# Every test also runs with the evaluation modes that must not change results
+FLAG_SETS = {"default": (), "jit": ("--jit",), "lazy-parse": ("--lazy-parse",)}
+
+
+@pytest.mark.parametrize("flags", FLAG_SETS.values(), ids=FLAG_SETS.keys())
 @pytest.mark.parametrize("herb_file", discover_tests(), ids=get_test_id)
-def test_exec(herb_file: Path) -> None:
-    run_test(herb_file)
+def test_exec(herb_file: Path, flags: Sequence[str]) -> None:
+    run_test(herb_file, flags)
+
+
+def test_scripts_side_by_side() -> None:
+    # A small fuel makes the scheduler switch scripts often
+    test_files = [
+        test_file
+        for test_file in discover_tests()
+        if ".skip" not in test_file.suffixes
+    ]
+    result = run_binary(
+        [
+            str(get_compiler_binary()),
+            "--threads=2",
+            "--fuel=7",
+            *map(str, test_files),
+        ]
+    )
+    if result.returncode != 0:
+        pytest.fail(
+            f"[Execution Error] side by side\n\n----- CAPTURED OUTPUT -----\n{result.stdout}"
+        )
+
+
+def test_untouched_futures_on_workers() -> None:
+    test_file = get_test_suite_root() / "026_untouched_future.flang"
+    execute_compiled_binary(get_test_id(test_file), test_file, ["--threads=4"])
+
+
+def test_cyclic_garbage_is_freed() -> None:
+    test_file = get_test_suite_root() / "027_cyclic_garbage.flang"
+    result = run_binary([str(get_compiler_binary()), "--stats", str(test_file)])
+    assert result.returncode == 0, result.stdout
+    freed = next(line for line in result.stdout.splitlines() if "freed containers" in line)
+    assert int(freed.split()[-1]) > 0
+
+
+@pytest.mark.parametrize(
+    "flag", ["--sample-profile=abc", "--sample-profile=0", "--threads=x", "--fuel="]
+)
+def test_invalid_option_value(flag: str) -> None:
+    test_file = get_test_suite_root() / "000_simple_assert.flang"
+    result = run_binary([str(get_compiler_binary()), flag, str(test_file)])
+    assert result.returncode != 0
+    assert f"invalid value for {flag.split('=')[0]}" in result.stdout
+    assert "Usage:" in result.stdout
+
+
+def test_makearray_too_long(tmp_path: Path) -> None:
+    script = tmp_path / "huge_array.flang"
+    script.write_text("(makearray (times 1000000 1000000))\n")
+    result = run_binary([str(get_compiler_binary()), str(script)])
+    assert result.returncode != 0
+    assert "makearray length 1000000000000 exceeds the maximum" in result.stdout
+
+
+def test_sample_profile_at_one_hertz(tmp_path: Path) -> None:
+    # The first sample is taken after a second of CPU time, so the work grows
+    # until a run takes longer than that, however fast the build is
+    script = tmp_path / "fib.flang"
+    for n in range(20, 40):
+        script.write_text(
+            "(func fib (n) (cond (less n 2) n (plus (fib (minus n 1)) (fib (minus n 2)))))\n"
+            f"(print (fib {n}))\n"
+        )
+        cpu_before = resource.getrusage(resource.RUSAGE_CHILDREN).ru_utime
+        result = run_binary([str(get_compiler_binary()), "--sample-profile=1", str(script)])
+        assert result.returncode == 0
+        if resource.getrusage(resource.RUSAGE_CHILDREN).ru_utime - cpu_before > 1.5:
+            break
+    assert "<toplevel>;" in result.stdout
@@ -0,0 +1,72 @@
+#include <gtest/gtest.h>
+#include <sstream>
+
+#include "flang/embed.hpp"
+#include "flang/flang_exception.hpp"
+
+namespace flang
+{
+namespace
+{
+
+int64_t integerValue(std::shared_ptr<Element> const& element)
+{
+    EXPECT_TRUE(element != nullptr && isa<Integer>(*element));
+    return element != nullptr && isa<Integer>(*element) ? static_cast<Integer const&>(*element).getValue() : 0;
+}
+
+TEST(ExecutionContext, RunReturnsTheValueOfTheLastForm)
+{
+    std::stringbuf output;
+    ExecutionContext context(&output);
+    PreparedProgram program("(print 1) (plus 2 3)");
+    EXPECT_EQ(integerValue(context.run(program)), 5);
+    EXPECT_EQ(output.str(), "1");
+}
+
+TEST(ExecutionContext, BoundValuesAreSeenByEveryRun)
+{
+    std::stringbuf output;
+    ExecutionContext context(&output);
+    PreparedProgram program("(setq amount (plus amount 1))");
+    context.bind("amount", makeInteger(120));
+    EXPECT_EQ(integerValue(context.run(program)), 121);
+    EXPECT_EQ(integerValue(context.run(program)), 121);
+    context.bind("amount", makeInteger(7));
+    EXPECT_EQ(integerValue(context.run(program)), 8);
+}
+
+TEST(ExecutionContext, RunDropsTheGlobalsOfThePreviousRun)
+{
+    std::stringbuf output;
+    ExecutionContext context(&output);
+    context.run(PreparedProgram("(setq x 1) (func f () 2)"));
+    EXPECT_EQ(integerValue(context.get("x")), 1);
+    EXPECT_NE(context.get("f"), nullptr);
+
+    context.run(PreparedProgram("(setq y 3)"));
+    EXPECT_EQ(context.get("x"), nullptr);
+    EXPECT_EQ(context.get("f"), nullptr);
+    EXPECT_EQ(integerValue(context.get("y")), 3);
+}
+
+TEST(ExecutionContext, StaysUsableAfterARuntimeError)
+{
+    std::stringbuf output;
+    ExecutionContext context(&output);
+    EXPECT_THROW(context.run(PreparedProgram("(setq x 1) (print 4) (assert false)")), flang_runtime_error);
+    // Output before the error is flushed
+    EXPECT_EQ(output.str(), "4");
+
+    EXPECT_EQ(integerValue(context.run(PreparedProgram("(func f (n) (times n 2)) (f 21)"))), 42);
+    EXPECT_EQ(context.get("x"), nullptr);
+}
+
+TEST(PreparedProgram, SyntaxErrorsAreThrown)
+{
+    EXPECT_THROW(PreparedProgram("(plus 1 2"), parser_exception);
+    EXPECT_THROW(PreparedProgram("(plus 1 #)"), tokenizer_exception);
+}
+
+} // namespace
+} // namespace flang